@@ -26,7 +26,6 @@
 #define ANDBITS2 (1<<MAXCUTBITS2) -1
 #define MAXNODES 5000000
 #define MAXRULES 1000000
-#define MAXPACKETS 1000000 //to avoid segmentation fault, please change stack size to 81920 or larger, run "ulimit -s 81920"
 #define MAXBUCKETS 40
 #define RULE_SIZE 16
 #define NODE_SIZE 32
@@ -49,8 +48,49 @@
 
 #define POINT_SIZE_BITS 32
 
+// Software prefetch hint (read, keep in all cache levels)
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(addr) __builtin_prefetch(static_cast<const void*>(addr), 0, 3)
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define PREFETCH(addr) _mm_prefetch(reinterpret_cast<const char*>(addr), _MM_HINT_T0)
+#else
+#define PREFETCH(addr) ((void)0)
+#endif
+
 typedef uint32_t Point;
 typedef std::vector<Point> Packet;
+
+// Fixed-width classification key: the 5-tuple plus the trace's flow id, padded to 32 bytes
+// so a header never straddles a cache line. This is the native key of the search path;
+// Packet is only kept as an adapter for callers that still build vectors.
+struct alignas(32) PacketHeader {
+    Point field[MAXDIMENSIONS];
+    uint32_t flowId;
+    uint32_t reserved[2];
+
+    PacketHeader() : field{0, 0, 0, 0, 0}, flowId(0), reserved{0, 0} {}
+
+    PacketHeader(Point sa, Point da, Point sp, Point dp, Point proto, uint32_t fid = 0)
+        : field{sa, da, sp, dp, proto}, flowId(fid), reserved{0, 0} {}
+
+    // Adapter from the vector form; element MAXDIMENSIONS, when present, is the flow id
+    explicit PacketHeader(const Packet &p) : PacketHeader() {
+        for (int d = 0; d < MAXDIMENSIONS && d < static_cast<int>(p.size()); d++) {
+            field[d] = p[d];
+        }
+        if (p.size() > MAXDIMENSIONS) {
+            flowId = p[MAXDIMENSIONS];
+        }
+    }
+
+    inline Point operator[](int d) const { return field[d]; }
+
+    Packet ToPacket() const {
+        return Packet{field[0], field[1], field[2], field[3], field[4], flowId};
+    }
+};
+static_assert(sizeof(PacketHeader) == 32, "PacketHeader must stay 32 bytes");
 typedef uint32_t Memory;
 
 enum NodeType {Cuts, Linear, WRS};
@@ -59,7 +99,7 @@ struct Rule {
     //Rule(){};
     //
     Rule(int dim = 5) : dim(dim), priority(0), id(0), tag(0), markedDelete(0), 
-                        prefix_length(dim, 0), range(dim, {{0, 0}}) { }
+                        prefix_length{}, range{} { }
 
     int dim;
     int priority;
@@ -68,11 +108,15 @@ struct Rule {
     int tag;
     bool markedDelete = 0;
 
-    std::vector<unsigned> prefix_length;
+    // Fixed size, so a rule is one flat record: copying it allocates nothing, and rules
+    // held in a tree arena need no destructor
+    std::array<unsigned, MAXDIMENSIONS> prefix_length;
 
-    std::vector<std::array<Point, 2>> range;
+    std::array<std::array<Point, 2>, MAXDIMENSIONS> range;
 
-    inline bool MatchesPacket(const Packet &p) const {
+    // Accepts a PacketHeader or the Packet adapter
+    template <typename Key>
+    inline bool MatchesPacket(const Key &p) const {
         if (p[0] < range[0][LowDim] || p[0] > range[0][HighDim]) return false;
         if (p[1] < range[1][LowDim] || p[1] > range[1][HighDim]) return false;
         if (p[2] < range[2][LowDim] || p[2] > range[2][HighDim]) return false;
@@ -81,11 +125,6 @@ struct Rule {
         return true;
     }
 
-    // //  Ban SIMD
-    // inline bool MatchesPacketSIMD(const Packet &p) const {
-    //     return MatchesPacket(p);  
-    // }
-
     int inline Getbit(int field, int bit) const {
         if(prefix_length[field] <= bit) {
             return -1;
@@ -143,13 +182,46 @@ struct Rule {
     }
 };
 
+// Lookup statistics of one thread. Concurrent lookups each fill their own instance,
+// which are merged on demand; nothing here is shared between threads.
+struct LookupStats {
+    uint64_t packets = 0;
+    uint64_t queryCount = 0;
+    uint64_t worstQuery = 0;
+    std::vector<uint64_t> histogram;  // histogram[q]: packets that took q memory accesses
+
+    inline void Record(uint64_t query) {
+        if (query >= histogram.size()) {
+            histogram.resize(query + 1, 0);
+        }
+        histogram[query]++;
+        packets++;
+        queryCount += query;
+        worstQuery = std::max(worstQuery, query);
+    }
+
+    void Merge(const LookupStats &other) {
+        if (other.histogram.size() > histogram.size()) {
+            histogram.resize(other.histogram.size(), 0);
+        }
+        for (size_t q = 0; q < other.histogram.size(); q++) {
+            histogram[q] += other.histogram[q];
+        }
+        packets += other.packets;
+        queryCount += other.queryCount;
+        worstQuery = std::max(worstQuery, other.worstQuery);
+    }
+};
+
 class PacketClassifier {
 public:
     virtual ~PacketClassifier() = default;
     
     virtual void ConstructClassifier(const std::vector<Rule> &rules) = 0;
 
-    virtual int ClassifyAPacket(const Packet &packet) = 0;
+    virtual int ClassifyAPacket(const PacketHeader &header) = 0;
+
+    int ClassifyAPacket(const Packet &packet) { return ClassifyAPacket(PacketHeader(packet)); }
 
     virtual void DeleteRule(const Rule &rule) = 0;
 
@@ -157,27 +229,28 @@ public:
 
     virtual Memory MemSizeBytes() const = 0;
 
-    virtual int MemoryAccess() const { return queryCount;}
+    virtual int MemoryAccess() const { return stats.queryCount;}
 
-    virtual int WorstMemoryAccess() const { return worstQuery;}
+    virtual int WorstMemoryAccess() const { return stats.worstQuery;}
 
     virtual size_t NumTables() const = 0;
 
     virtual size_t RulesInTable(size_t tableIndex) const = 0;
 
-    int TablesQueried() const { return queryCount; }
+    int TablesQueried() const { return stats.queryCount; }
+
+    // Statistics of ClassifyAPacket calls plus everything merged in with MergeStats
+    const LookupStats& Stats() const { return stats; }
+
+    void MergeStats(const LookupStats &threadStats) { stats.Merge(threadStats); }
 
 protected:
     void QueryUpdate(uint64_t query) {
-        packetHistogram[query]++;
-        worstQuery = std::max(worstQuery, query);
-        queryCount += query;
+        stats.Record(query);
     }
 
 private:
-    uint64_t queryCount = 0;
-    uint64_t worstQuery = 0;
-    std::unordered_map<int, int> packetHistogram;
+    LookupStats stats;
 };
 
 inline void SortRules(std::vector<Rule> &rules) {
@@ -0,0 +1,68 @@
+#ifndef BIT_SCAN_H
+#define BIT_SCAN_H
+
+#include <cstdint>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Bit scans on compiler intrinsics where there are some, a loop elsewhere. Each value
+// must be non-zero.
+
+// Index of the lowest set bit
+inline int CountTrailingZeros64(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(value);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<int>(index);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, static_cast<unsigned long>(value))) {
+        return static_cast<int>(index);
+    }
+    _BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+    return static_cast<int>(index) + 32;
+#else
+    int zeros = 0;
+    while (!(value & 1)) {
+        value >>= 1;
+        zeros++;
+    }
+    return zeros;
+#endif
+}
+
+// Number of zero bits above the highest set bit
+inline int CountLeadingZeros32(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clz(value);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return 31 - static_cast<int>(index);
+#else
+    int zeros = 0;
+    while (!(value & 0x80000000u)) {
+        value <<= 1;
+        zeros++;
+    }
+    return zeros;
+#endif
+}
+
+inline int CountLeadingZeros64(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(value);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - static_cast<int>(index);
+#else
+    uint32_t high = static_cast<uint32_t>(value >> 32);
+    return high ? CountLeadingZeros32(high) : 32 + CountLeadingZeros32(static_cast<uint32_t>(value));
+#endif
+}
+
+#endif // BIT_SCAN_H
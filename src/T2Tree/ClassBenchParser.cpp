@@ -0,0 +1,355 @@
+#include "ClassBenchParser.h"
+#include "BitScan.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// ========== MappedFile ==========
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const char* path) {
+    Close();
+#ifdef _WIN32
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return false;
+    fseek(fp, 0, SEEK_END);
+    long bytes = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (bytes < 0) {
+        fclose(fp);
+        return false;
+    }
+    char* buffer = bytes > 0 ? static_cast<char*>(malloc(bytes)) : nullptr;
+    if (bytes > 0 && (!buffer || fread(buffer, 1, bytes, fp) != static_cast<size_t>(bytes))) {
+        free(buffer);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    data = buffer;
+    size = static_cast<size_t>(bytes);
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {  // Nothing to map
+        close(fd);
+        return true;
+    }
+    void* base = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    madvise(base, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    data = static_cast<const char*>(base);
+    size = static_cast<size_t>(st.st_size);
+    return true;
+#endif
+}
+
+void MappedFile::Close() {
+    if (!data) return;
+#ifdef _WIN32
+    free(const_cast<char*>(data));
+#else
+    munmap(const_cast<char*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+// ========== Scanner ==========
+// The scanners never look for the end of the input: every line they are given ends in
+// '\n', which stops the search for the next number, and numbers are read eight digits at a
+// time, so the bytes up to SCAN_PADDING past a line's newline must be readable.
+// ForEachLine hands the last lines of a buffer over as a terminated, padded copy.
+static constexpr size_t SCAN_PADDING = 16;
+
+static inline bool IsDigit(char c) {
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+// Value of a hex digit, or -1
+static inline int HexValue(char c) {
+    unsigned d = static_cast<unsigned char>(c - '0');
+    if (d < 10) return static_cast<int>(d);
+    unsigned h = static_cast<unsigned char>((c | 0x20) - 'a');
+    return h < 6 ? static_cast<int>(h) + 10 : -1;
+}
+
+// Moves p to the next digit on its line; false, with p on the '\n', when there is none
+static inline bool NextNumber(const char*& p) {
+    while (!IsDigit(*p)) {
+        if (*p == '\n') return false;
+        p++;
+    }
+    return true;
+}
+
+// Value of the digits at p, of which there are 1 to 8, read without a branch per digit
+static inline uint32_t EightDigits(const char* p, int& length) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    uint64_t digits = word - 0x3030303030303030ULL;
+    // High bit of every byte that is not a digit; borrows only reach bytes after the first
+    uint64_t stops = (digits | (digits + 0x7676767676767676ULL)) & 0x8080808080808080ULL;
+    length = stops ? CountTrailingZeros64(stops) >> 3 : 8;
+    // Keep the digits as the most significant bytes, so the rest read as leading zeros
+    digits = length == 8 ? digits : digits << (64 - 8 * length);
+    digits = (digits * 10 + (digits >> 8)) & 0x00FF00FF00FF00FFULL;
+    digits = (digits * 100 + (digits >> 16)) & 0x0000FFFF0000FFFFULL;
+    return static_cast<uint32_t>(digits * 10000 + (digits >> 32));
+}
+
+static inline uint32_t ReadDecimal(const char*& p) {
+    static const uint32_t scale[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+    int length;
+    uint32_t value = EightDigits(p, length);
+    p += length;
+    if (length == 8 && IsDigit(*p)) {  // Addresses written as one number take up to ten digits
+        uint32_t low = EightDigits(p, length);
+        value = value * scale[length] + low;
+        p += length;
+    }
+    return value;
+}
+
+// Reads a hex number with or without its 0x prefix
+static inline uint32_t ReadHex(const char*& p) {
+    if (p[0] == '0' && (p[1] | 0x20) == 'x') p += 2;
+    uint32_t value = 0;
+    int digit;
+    while ((digit = HexValue(*p)) >= 0) {
+        value = (value << 4) | static_cast<uint32_t>(digit);
+        p++;
+    }
+    return value;
+}
+
+static inline const char* SkipLine(const char* p) {
+    while (*p != '\n') p++;
+    return p + 1;
+}
+
+// Calls parseLine(p, line) for each line in [begin, end), numbering lines from firstLine.
+// parseLine returns the start of the next line, or nullptr to stop with a failure.
+template <typename ParseLine>
+static bool ForEachLine(const char* begin, const char* end, size_t firstLine, ParseLine&& parseLine) {
+    size_t line = firstLine;
+    auto parseLines = [&](const char* p, const char* stop) {
+        for (; p < stop; line++) {
+            p = parseLine(p, line);
+            if (!p) return false;
+        }
+        return true;
+    };
+
+    // Lines ending at least SCAN_PADDING bytes before end are parsed in place
+    const char* last = end - std::min(static_cast<size_t>(end - begin), SCAN_PADDING);
+    while (last > begin && last[-1] != '\n') last--;
+    if (!parseLines(begin, last)) return false;
+    if (last == end) return true;
+
+    std::string tail(last, end);
+    if (tail.back() != '\n') tail.push_back('\n');
+    size_t length = tail.size();
+    tail.append(SCAN_PADDING, '\0');
+    return parseLines(tail.data(), tail.data() + length);
+}
+
+size_t CountLines(const char* begin, const char* end) {
+    size_t lines = 0;
+    const char* p = begin;
+    while (p < end) {
+        const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!newline) return lines + 1;
+        lines++;
+        p = newline + 1;
+    }
+    return lines;
+}
+
+// ========== Rules ==========
+static inline std::array<Point, 2> PrefixRange(uint32_t address, uint32_t length) {
+    uint32_t mask = length == 0 ? 0 : ~0u << (32 - length);
+    return {address & mask, (address & mask) | ~mask};
+}
+
+// Leading bits shared by the two ends of a 16-bit port range
+static inline unsigned PortPrefixLength(uint32_t low, uint32_t high) {
+    uint32_t diff = (low ^ high) & 0xFFFF;
+    return diff == 0 ? 16 : static_cast<unsigned>(CountLeadingZeros32(diff)) - 16;
+}
+
+// Fills r from the rule line at p; returns the reason when the line is malformed
+static const char* ParseRuleLine(const char*& p, Rule& r) {
+    uint32_t field[14];
+    for (int i = 0; i < 14; i++) {
+        if (!NextNumber(p)) return "missing fields";
+        field[i] = ReadDecimal(p);
+    }
+    uint32_t number[2];
+    for (int i = 0; i < 2; i++) {
+        if (!NextNumber(p)) return "missing fields";
+        number[i] = ReadHex(p);
+    }
+    uint32_t protocol = number[0];
+    uint32_t protocolMask = number[1];
+
+    uint32_t source = field[0] << 24 | field[1] << 16 | field[2] << 8 | field[3];
+    uint32_t destination = field[5] << 24 | field[6] << 16 | field[7] << 8 | field[8];
+    if (field[4] > 32) return "Src IP length exceeds 32";
+    if (field[9] > 32) return "Dest IP length exceeds 32";
+    if (protocolMask != 0xFF && protocolMask != 0) return "Protocol mask error";
+
+    r.range[0] = PrefixRange(source, field[4]);
+    r.range[1] = PrefixRange(destination, field[9]);
+    r.range[2] = {field[10], field[11]};
+    r.range[3] = {field[12], field[13]};
+    r.range[4] = protocolMask ? std::array<Point, 2>{protocol, protocol} : std::array<Point, 2>{0, 0xFF};
+    r.prefix_length[0] = field[4];
+    r.prefix_length[1] = field[9];
+    r.prefix_length[2] = PortPrefixLength(field[10], field[11]);
+    r.prefix_length[3] = PortPrefixLength(field[12], field[13]);
+    r.prefix_length[4] = protocolMask;
+    return nullptr;
+}
+
+bool ParseClassBenchRules(const char* begin, const char* end, std::vector<Rule>& rules) {
+    size_t first = rules.size();
+    rules.reserve(first + CountLines(begin, end));
+
+    bool ok = ForEachLine(begin, end, 1, [&rules](const char* p, size_t line) -> const char* {
+        const char* start = p;
+        if (!NextNumber(start)) {  // Blank line
+            return start + 1;
+        }
+        Rule r;
+        const char* error = ParseRuleLine(p, r);
+        if (error) {
+            printf("Rule line %zu: %s\n", line, error);
+            return nullptr;
+        }
+        r.id = static_cast<int>(rules.size());
+        rules.push_back(r);
+        return SkipLine(p);
+    });
+
+    int maxPriority = static_cast<int>(rules.size()) - 1;
+    for (size_t i = first; i < rules.size(); i++) {
+        rules[i].priority = maxPriority - static_cast<int>(i);
+    }
+    return ok;
+}
+
+bool LoadClassBenchRules(const char* path, std::vector<Rule>& rules) {
+    MappedFile file;
+    if (!file.Open(path)) {
+        printf("Cannot open rule file %s\n", path);
+        return false;
+    }
+    return ParseClassBenchRules(file.Data(), file.Data() + file.Size(), rules);
+}
+
+// ========== Trace ==========
+long ParseClassBenchTrace(const char* begin, const char* end, PacketHeader* out, size_t firstLine) {
+    PacketHeader* next = out;
+    bool ok = ForEachLine(begin, end, firstLine, [&next](const char* p, size_t line) -> const char* {
+        uint32_t field[7];
+        int fields = 0;
+        while (fields < 7 && NextNumber(p)) {
+            field[fields++] = ReadDecimal(p);
+        }
+        if (fields >= 6) {
+            // The flow id is the last column, after the protocol mask when there is one
+            *next++ = PacketHeader(field[0], field[1], field[2], field[3], field[4], field[fields - 1]);
+        } else if (fields > 0) {
+            printf("Trace line %zu: missing fields\n", line);
+            return nullptr;
+        }
+        return SkipLine(p);
+    });
+    return ok ? next - out : -1;
+}
+
+bool LoadClassBenchTrace(const char* path, std::vector<PacketHeader>& packets, int threads) {
+    MappedFile file;
+    if (!file.Open(path)) {
+        printf("Cannot open trace file %s\n", path);
+        return false;
+    }
+    const char* begin = file.Data();
+    const char* end = begin + file.Size();
+
+    if (threads <= 0) {
+        threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    if (file.Size() < TRACE_PARALLEL_BYTES) {
+        threads = 1;
+    }
+
+    // Chunk i covers [cut[i], cut[i + 1]); every cut but the first follows a newline
+    std::vector<const char*> cut(threads + 1, end);
+    cut[0] = begin;
+    for (int i = 1; i < threads; i++) {
+        const char* p = std::max(begin + file.Size() / threads * i, cut[i - 1]);
+        const char* newline = p < end ? static_cast<const char*>(memchr(p, '\n', end - p)) : nullptr;
+        cut[i] = newline ? newline + 1 : end;
+    }
+
+    auto runChunks = [threads](auto&& work) {
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads; i++) {
+            workers.emplace_back(work, i);
+        }
+        work(0);
+        for (auto& t : workers) {
+            t.join();
+        }
+    };
+
+    // Count first so every chunk can parse straight into its place in packets
+    std::vector<size_t> lines(threads), offset(threads + 1, 0);
+    runChunks([&](int i) { lines[i] = CountLines(cut[i], cut[i + 1]); });
+    for (int i = 0; i < threads; i++) {
+        offset[i + 1] = offset[i] + lines[i];
+    }
+
+    size_t base = packets.size();
+    packets.resize(base + offset[threads]);
+    std::vector<long> parsed(threads);
+    runChunks([&](int i) {
+        parsed[i] = ParseClassBenchTrace(cut[i], cut[i + 1], packets.data() + base + offset[i], offset[i] + 1);
+    });
+
+    // Close the gaps that blank lines left between chunks
+    size_t count = base;
+    for (int i = 0; i < threads; i++) {
+        if (parsed[i] < 0) {
+            packets.resize(base);
+            return false;
+        }
+        if (count != base + offset[i]) {
+            memmove(packets.data() + count, packets.data() + base + offset[i], parsed[i] * sizeof(PacketHeader));
+        }
+        count += parsed[i];
+    }
+    packets.resize(count);
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef CLASSBENCH_PARSER_H
+#define CLASSBENCH_PARSER_H
+
+#include "../ElementaryClasses.h"
+#include <vector>
+#include <cstddef>
+
+// Readers for the ClassBench rule and trace formats:
+//
+//   rules:  @sip/smask  dip/dmask  sport1 : sport2  dport1 : dport2  proto/protomask  flags/flagsmask
+//   trace:  sip dip sport dport proto [protomask] flowId
+//
+// The whole file is mapped and scanned in place; numbers are read straight into the output
+// arrays without any per-line allocation or format-string matching. Rules get ids in file
+// order and priorities from the top down (the first rule wins), as ClassBench expects.
+
+// Read-only view of a file, mapped where the platform allows and read into memory elsewhere
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const char* path);
+    void Close();
+
+    const char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+// Number of lines in [begin, end), counting a last line without its newline
+size_t CountLines(const char* begin, const char* end);
+
+// Parses the rule lines in [begin, end), appending to rules. Reports the first malformed
+// line and returns false; the rules before it are kept.
+bool ParseClassBenchRules(const char* begin, const char* end, std::vector<Rule>& rules);
+
+// Parses the trace lines in [begin, end) into out, which must have room for CountLines()
+// entries. Blank lines are skipped; returns the number of packets written, or -1 with the
+// offending line reported when a line is malformed. Lines are numbered from firstLine.
+long ParseClassBenchTrace(const char* begin, const char* end, PacketHeader* out, size_t firstLine = 1);
+
+bool LoadClassBenchRules(const char* path, std::vector<Rule>& rules);
+
+// Traces above TRACE_PARALLEL_BYTES are cut at line boundaries into one chunk per thread
+// (0 = one per hardware thread) and parsed concurrently into their final place in packets.
+static constexpr size_t TRACE_PARALLEL_BYTES = 4 << 20;
+bool LoadClassBenchTrace(const char* path, std::vector<PacketHeader>& packets, int threads = 0);
+
+#endif // CLASSBENCH_PARSER_H
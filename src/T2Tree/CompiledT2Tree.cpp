@@ -0,0 +1,385 @@
+#include "CompiledT2Tree.h"
+#include "T2Tree.h"
+#include <queue>
+#include <algorithm>
+
+static const int maxMask[MAXDIMENSIONS] = {31, 31, 15, 15, 7};
+
+// ========== Storage ==========
+CompiledT2Tree::~CompiledT2Tree() {
+    if (mapped) return;
+    uint32_t* current = published.load(std::memory_order_relaxed);
+    if (data != current) {
+        delete[] data;
+    }
+    if (current) {
+        EpochReclaimer::Retire([current]() { delete[] current; });
+    }
+}
+
+CompiledT2Tree::CompiledT2Tree(CompiledT2Tree&& other) noexcept
+    : data(other.data), published(other.published.load(std::memory_order_relaxed)), used(other.used),
+      capacity(other.capacity), garbageWords(other.garbageWords), master(other.master),
+      copyOnWrite(other.copyOnWrite), mapped(other.mapped) {
+    other.data = nullptr;
+    other.published.store(nullptr, std::memory_order_relaxed);
+    other.used = other.capacity = other.garbageWords = 0;
+    other.master = nullptr;
+}
+
+CompiledT2Tree& CompiledT2Tree::operator=(CompiledT2Tree&& other) noexcept {
+    if (this != &other) {
+        this->~CompiledT2Tree();
+        new (this) CompiledT2Tree(std::move(other));
+    }
+    return *this;
+}
+
+void CompiledT2Tree::Map(const uint32_t* words, size_t count) {
+    this->~CompiledT2Tree();
+    new (this) CompiledT2Tree();
+    mapped = true;
+    used = capacity = count;
+    // Lookups never write through published; the cast only fits the shared member type
+    data = const_cast<uint32_t*>(words);
+    published.store(data, std::memory_order_release);
+}
+
+bool CompiledT2Tree::Validate(const uint32_t* words, size_t count) {
+    if (count < 1) return false;
+    const uint64_t internalWords = sizeof(ImageInternalNode) / sizeof(uint32_t);
+    std::vector<bool> visited(count, false);
+    std::vector<uint32_t> pending;
+    if (words[0] != 0) {
+        pending.push_back(words[0]);
+    }
+
+    while (!pending.empty()) {
+        uint64_t offset = pending.back();
+        pending.pop_back();
+        if (offset == 0 || offset + 2 > count || visited[offset]) return false;
+        visited[offset] = true;
+
+        if (words[offset] == IMAGE_LEAF) {
+            if (offset + 4 > count) return false;
+            const RuleBlock* block = reinterpret_cast<const RuleBlock*>(words + offset + 2);
+            uint64_t blockWords = 2 + static_cast<uint64_t>(RULE_BLOCK_COLUMNS) * block->stride;
+            if (block->count > block->stride || offset + 2 + blockWords > count) return false;
+            continue;
+        }
+        if (words[offset] != IMAGE_INTERNAL || offset + internalWords > count) return false;
+
+        const ImageInternalNode* node = reinterpret_cast<const ImageInternalNode*>(words + offset);
+        if (node->nSelect > 31 || offset + internalWords + node->nSelect + node->nChildren > count) return false;
+        for (uint32_t i = 0; i < node->nSelect; i++) {
+            uint32_t select = node->Select()[i];
+            if ((select & 0xFF) >= MAXDIMENSIONS || (select >> 8) >= 32) return false;
+        }
+        for (uint32_t i = 0; i < node->nChildren; i++) {
+            if (node->Children()[i] != 0) {
+                pending.push_back(node->Children()[i]);
+            }
+        }
+
+        // Lookups search the WRS index whenever its priority can win
+        if (node->wrsOffset == 0) {
+            if (node->maxWRSPriority >= 0) return false;
+            continue;
+        }
+        uint64_t wrs = node->wrsOffset;
+        if (wrs + TupleSpaceIndex::HEADER_WORDS > count) return false;
+        uint64_t wrsWords = words[wrs + 2];
+        if (wrs + wrsWords > count || !TupleSpaceIndex::Validate(words + wrs, wrsWords)) return false;
+    }
+    return true;
+}
+
+// Reserve words at the end of the writer's buffer. Growing copies into a new buffer; the
+// published one stays untouched until Publish() so concurrent lookups keep a stable view.
+uint32_t CompiledT2Tree::Allocate(size_t words) {
+    if (used + words > capacity) {
+        size_t grownCapacity = std::max(capacity * 2, used + words + 64);
+        uint32_t* grown = new uint32_t[grownCapacity]();
+        std::copy(data, data + used, grown);
+        if (data != published.load(std::memory_order_relaxed)) {
+            delete[] data;  // Intermediate buffer no lookup has seen
+        }
+        data = grown;
+        capacity = grownCapacity;
+    }
+    uint32_t offset = static_cast<uint32_t>(used);
+    used += words;
+    return offset;
+}
+
+void CompiledT2Tree::Publish() {
+    uint32_t* old = published.load(std::memory_order_relaxed);
+    if (old == data) return;
+    published.store(data, std::memory_order_release);
+    if (old) {
+        EpochReclaimer::Retire([old]() { delete[] old; });
+    }
+}
+
+// ========== Layout ==========
+uint32_t CompiledT2Tree::BlockCapacity(size_t count) {
+    // Keep at least one free slot so a single insert can be patched in place
+    return RuleBlock::StrideFor(count + 1);
+}
+
+uint32_t CompiledT2Tree::NodeWords(const T2TreeNode* node, uint32_t* blockCapacity) const {
+    if (node->isLeaf) {
+        *blockCapacity = BlockCapacity(node->classifier.size());
+        return 2 + BlockWords(*blockCapacity);
+    }
+
+    uint32_t nSelect = 0;
+    for (size_t i = 0; i < node->opt.size(); i++) {
+        if (node->opt[i] != -1 && node->bit[i] != -1) {
+            nSelect++;
+        }
+    }
+    uint32_t size = static_cast<uint32_t>(sizeof(ImageInternalNode) / sizeof(uint32_t)) +
+                    nSelect + static_cast<uint32_t>(node->children.size());
+
+    *blockCapacity = 0;
+    if (node->hasWRS && node->wrsNode) {
+        *blockCapacity = IndexCapacity(node->wrsNode->getIndexWords().size());
+        size += *blockCapacity;
+    }
+    return size;
+}
+
+// ========== Compilation ==========
+void CompiledT2Tree::Build(T2TreeNode* rootNode) {
+    master = rootNode;
+    garbageWords = 0;
+
+    // Breadth-first layout keeps the upper levels, touched by every packet, together
+    std::vector<T2TreeNode*> order;
+    std::vector<uint32_t> capacity;
+    std::queue<T2TreeNode*> que;
+    if (rootNode) {
+        que.push(rootNode);
+    }
+    uint32_t cursor = 1;  // Word 0 holds the root offset, so offset 0 means "no node"
+
+    while (!que.empty()) {
+        T2TreeNode* node = que.front();
+        que.pop();
+
+        uint32_t blockCapacity;
+        node->imageOffset = cursor;
+        cursor += NodeWords(node, &blockCapacity);
+        order.push_back(node);
+        capacity.push_back(blockCapacity);
+
+        for (auto child : node->children) {
+            if (child) {
+                que.push(child);
+            }
+        }
+    }
+
+    // Always a fresh buffer, with headroom for incremental updates before the first growth
+    size_t freshCapacity = cursor + cursor / 4 + 64;
+    uint32_t* fresh = new uint32_t[freshCapacity]();
+    if (data != published.load(std::memory_order_relaxed)) {
+        delete[] data;
+    }
+    data = fresh;
+    this->capacity = freshCapacity;
+    used = cursor;
+
+    for (size_t i = 0; i < order.size(); i++) {
+        WriteNode(order[i], order[i]->imageOffset, capacity[i]);
+    }
+    data[0] = rootNode ? rootNode->imageOffset : 0;
+    Publish();
+}
+
+void CompiledT2Tree::WriteBlock(uint32_t offset, const ArenaVector<Rule>& rules, uint32_t capacity) {
+    RuleBlock::Write(data + offset, capacity, rules.data(), rules.size());
+}
+
+// The WRS index is copied as is, its offsets are relative to its own first word. Slack
+// words are counted in its size so a later, larger version can be written in place.
+void CompiledT2Tree::WriteIndex(uint32_t offset, const std::vector<uint32_t>& index, uint32_t capacity) {
+    std::copy(index.begin(), index.end(), data + offset);
+    std::fill(data + offset + index.size(), data + offset + capacity, 0u);
+    data[offset + 2] = capacity;
+}
+
+void CompiledT2Tree::WriteNode(const T2TreeNode* node, uint32_t offset, uint32_t blockCapacity) {
+    if (node->isLeaf) {
+        ImageLeafNode* leaf = LeafAt(offset);
+        leaf->kind = IMAGE_LEAF;
+        leaf->maxLeafPriority = node->maxLeafPriority;
+        WriteBlock(offset + 2, node->classifier, blockCapacity);
+        return;
+    }
+
+    ImageInternalNode* inner = InternalAt(offset);
+    inner->kind = IMAGE_INTERNAL;
+    inner->maxSubtreePriority = node->maxSubtreePriority;
+    inner->maxWRSPriority = -1;
+    inner->wrsOffset = 0;
+    inner->nSelect = 0;
+    inner->nChildren = static_cast<uint32_t>(node->children.size());
+
+    uint32_t* select = reinterpret_cast<uint32_t*>(inner + 1);
+    for (size_t i = 0; i < node->opt.size(); i++) {
+        if (node->opt[i] == -1 || node->bit[i] == -1) {
+            continue;
+        }
+        uint32_t shift = static_cast<uint32_t>(maxMask[node->opt[i]] - node->bit[i]) & 31;
+        select[inner->nSelect++] = static_cast<uint32_t>(node->opt[i]) | (shift << 8);
+    }
+
+    uint32_t* children = inner->Children();
+    for (size_t i = 0; i < node->children.size(); i++) {
+        children[i] = node->children[i] ? node->children[i]->imageOffset : 0;
+    }
+
+    if (node->hasWRS && node->wrsNode) {
+        inner->wrsOffset = offset + static_cast<uint32_t>(sizeof(ImageInternalNode) / sizeof(uint32_t)) +
+                           inner->nSelect + inner->nChildren;
+        inner->maxWRSPriority = node->wrsNode->size() > 0 ? node->maxWRSPriority : -1;
+        WriteIndex(inner->wrsOffset, node->wrsNode->getIndexWords(), blockCapacity);
+    }
+}
+
+uint32_t CompiledT2Tree::Append(T2TreeNode* node) {
+    uint32_t blockCapacity;
+    uint32_t offset = Allocate(NodeWords(node, &blockCapacity));
+    node->imageOffset = offset;
+
+    // Children that were never compiled are appended first so their offsets are known
+    for (auto child : node->children) {
+        if (child && child->imageOffset == 0) {
+            Append(child);
+        }
+    }
+
+    WriteNode(node, offset, blockCapacity);
+    return offset;
+}
+
+// ========== Incremental Maintenance ==========
+void CompiledT2Tree::Relink(T2TreeNode* node, uint32_t offset) {
+    node->imageOffset = offset;
+    T2TreeNode* parent = node->parent;
+    if (!parent) {
+        StoreLink(data, offset);
+        return;
+    }
+    if (parent->imageOffset == 0) {
+        refresh(parent);  // Emitting the parent links all of its children
+        return;
+    }
+
+    size_t loc = 0;
+    while (loc < parent->children.size() && parent->children[loc] != node) {
+        loc++;
+    }
+
+    ImageInternalNode* inner = InternalAt(parent->imageOffset);
+    if (loc < inner->nChildren) {
+        StoreLink(inner->Children() + loc, offset);  // The only in-place write lookups can see
+        return;
+    }
+
+    // The child table grew: emit a new version of the parent
+    uint32_t unused;
+    garbageWords += NodeWords(parent, &unused);
+    uint32_t parentOffset = Append(parent);
+    Relink(parent, parentOffset);
+}
+
+void CompiledT2Tree::RefreshWRS(T2TreeNode* node) {
+    ImageInternalNode* inner = InternalAt(node->imageOffset);
+    if (!node->hasWRS || !node->wrsNode) {
+        inner->maxWRSPriority = -1;
+        return;
+    }
+
+    const auto& index = node->wrsNode->getIndexWords();
+    uint32_t wrsOffset = inner->wrsOffset;
+    if (wrsOffset == 0 || IndexAt(wrsOffset).Words() < index.size()) {
+        uint32_t capacity = IndexCapacity(index.size());
+        if (wrsOffset != 0) {
+            garbageWords += IndexAt(wrsOffset).Words();
+        }
+        wrsOffset = Allocate(capacity);
+        WriteIndex(wrsOffset, index, capacity);
+        inner = InternalAt(node->imageOffset);
+        inner->wrsOffset = wrsOffset;
+    } else {
+        WriteIndex(wrsOffset, index, IndexAt(wrsOffset).Words());
+    }
+    inner->maxWRSPriority = node->wrsNode->size() == 0 ? -1 : node->maxWRSPriority;
+}
+
+void CompiledT2Tree::Refresh(T2TreeNode* node) {
+    refresh(node);
+    StoreBounds(node);
+    Commit();
+}
+
+void CompiledT2Tree::Refresh(const std::vector<T2TreeNode*>& nodes) {
+    for (T2TreeNode* node : nodes) {
+        refresh(node);
+    }
+    // After every node is in place, so each ancestor gets the bound of its final version
+    for (T2TreeNode* node : nodes) {
+        StoreBounds(node);
+    }
+    Commit();
+}
+
+// The change may have moved the bounds of every internal node up to the root
+void CompiledT2Tree::StoreBounds(T2TreeNode* node) {
+    for (T2TreeNode* ancestor = node; ancestor; ancestor = ancestor->parent) {
+        if (!ancestor->isLeaf && ancestor->imageOffset != 0) {
+            StoreLink(reinterpret_cast<uint32_t*>(&InternalAt(ancestor->imageOffset)->maxSubtreePriority),
+                      static_cast<uint32_t>(ancestor->maxSubtreePriority));
+        }
+    }
+}
+
+void CompiledT2Tree::Commit() {
+    // Compact once superseded node versions make up half of the image
+    if (master && garbageWords > used / 2) {
+        Build(master);
+    } else {
+        Publish();
+    }
+}
+
+void CompiledT2Tree::refresh(T2TreeNode* node) {
+    if (node->imageOffset == 0) {
+        uint32_t offset = Append(node);
+        Relink(node, offset);
+    } else if (node->isLeaf) {
+        ImageLeafNode* leaf = LeafAt(node->imageOffset);
+        if (!copyOnWrite && node->classifier.size() <= leaf->rules.stride) {
+            leaf->maxLeafPriority = node->maxLeafPriority;
+            WriteBlock(node->imageOffset + 2, node->classifier, leaf->rules.stride);
+        } else {
+            garbageWords += 2 + BlockWords(leaf->rules.stride);
+            uint32_t offset = Append(node);
+            Relink(node, offset);
+        }
+    } else {
+        ImageInternalNode* inner = InternalAt(node->imageOffset);
+        if (copyOnWrite || inner->nChildren != node->children.size()) {
+            // New version of the whole node, swung in by Relink
+            uint32_t unused;
+            garbageWords += NodeWords(node, &unused);
+            uint32_t offset = Append(node);
+            Relink(node, offset);
+        } else {
+            RefreshWRS(node);
+        }
+    }
+}
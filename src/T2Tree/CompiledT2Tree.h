@@ -0,0 +1,166 @@
+#ifndef COMPILED_T2_TREE_H
+#define COMPILED_T2_TREE_H
+
+#include "../ElementaryClasses.h"
+#include "PackedRuleBlock.h"
+#include "TupleSpaceIndex.h"
+#include "EpochReclaimer.h"
+#include "TreeArena.h"
+#include "MemoryAccounting.h"
+#include <vector>
+#include <cstdint>
+#include <atomic>
+
+struct T2TreeNode;
+
+// Image node kinds
+#define IMAGE_INTERNAL 0
+#define IMAGE_LEAF 1
+
+// Internal node, followed by nSelect selector words and nChildren child offsets
+struct ImageInternalNode {
+    uint32_t kind;            // IMAGE_INTERNAL
+    int32_t maxSubtreePriority;  // Bound on every rule below, updated in place like a link
+    int32_t maxWRSPriority;   // -1 when the node has no WRS rules
+    uint32_t wrsOffset;       // Word offset of the WRS TupleSpaceIndex, 0 when absent
+    uint32_t nSelect;         // Selected bits: field | (shift << 8)
+    uint32_t nChildren;
+
+    const uint32_t* Select() const { return reinterpret_cast<const uint32_t*>(this + 1); }
+    const uint32_t* Children() const { return Select() + nSelect; }
+    uint32_t* Children() { return reinterpret_cast<uint32_t*>(this + 1) + nSelect; }
+
+    // Child links may be swung by a concurrent update, so lookups read them atomically
+    uint32_t Child(int loc) const { return LoadLink(Children() + loc); }
+
+    // A descent can stop here when the bound cannot beat the best match so far
+    int SubtreeBound() const {
+        return static_cast<int32_t>(LoadLink(reinterpret_cast<const uint32_t*>(&maxSubtreePriority)));
+    }
+
+    inline int Location(const PacketHeader& p) const {
+        const uint32_t* select = Select();
+        int loc = 0;
+        for (uint32_t i = 0; i < nSelect; i++) {
+            loc = (loc << 1) | static_cast<int>((p[select[i] & 0xFF] >> (select[i] >> 8)) & 1);
+        }
+        return loc;
+    }
+};
+
+// Leaf node, the rule block is stored inline right after the header
+struct ImageLeafNode {
+    uint32_t kind;            // IMAGE_LEAF
+    int32_t maxLeafPriority;
+    RuleBlock rules;          // Columns follow
+};
+
+// One published version of an image. A lookup takes the view once per tree and resolves
+// every offset against it, so a concurrent buffer swap can never mix two versions.
+struct ImageView {
+    const uint32_t* words;
+
+    uint32_t Root() const { return LoadLink(words); }  // Word 0 holds the root offset
+
+    const ImageInternalNode* Internal(uint32_t offset) const {
+        return reinterpret_cast<const ImageInternalNode*>(words + offset);
+    }
+    const ImageLeafNode* Leaf(uint32_t offset) const {
+        return reinterpret_cast<const ImageLeafNode*>(words + offset);
+    }
+    const RuleBlock* Block(uint32_t offset) const {
+        return reinterpret_cast<const RuleBlock*>(words + offset);
+    }
+    TupleSpaceIndex WRS(uint32_t offset) const { return TupleSpaceIndex{words + offset}; }
+};
+
+// Pointer-free search image of one subtree. All nodes live in one contiguous word array
+// and refer to each other by 32-bit word offsets (0 means "no node"). The image is
+// compiled from a T2TreeNode tree, which stays the master copy for updates: after a
+// node of the master changes, Refresh() patches the image in place, or appends a new
+// version of the node and relinks it when it no longer fits.
+//
+// In copy-on-write mode nothing reachable is ever modified except single link words:
+// every changed node is appended as a new version and swung in with one atomic store to
+// its parent's child slot (or the root word), and ancestors' subtree bounds are stored
+// the same way. When the buffer has to grow or is compacted,
+// the new buffer is published as a whole and the old one is retired through the
+// EpochReclaimer, so lookups running concurrently with Refresh() never block and never
+// observe a half-written node.
+class CompiledT2Tree {
+public:
+    CompiledT2Tree() = default;
+    ~CompiledT2Tree();
+    CompiledT2Tree(CompiledT2Tree&& other) noexcept;
+    CompiledT2Tree& operator=(CompiledT2Tree&& other) noexcept;
+    CompiledT2Tree(const CompiledT2Tree&) = delete;
+    CompiledT2Tree& operator=(const CompiledT2Tree&) = delete;
+
+    // Full compile of the tree rooted at root (records every node's imageOffset)
+    void Build(T2TreeNode* root);
+
+    // Re-publish one node of the master tree after it changed
+    void Refresh(T2TreeNode* node);
+    // Re-publish several changed nodes with a single publish (or compaction) at the end
+    void Refresh(const std::vector<T2TreeNode*>& nodes);
+
+    void SetCopyOnWrite(bool enable) { copyOnWrite = enable; }
+
+    // Serve lookups from an image that lives in external memory (a mapped snapshot). The
+    // memory must outlive this object; Build() or Refresh() must not be called afterwards.
+    void Map(const uint32_t* words, size_t count);
+
+    // Check that a word array of `count` words is a well-formed image (for mapped input):
+    // every node reachable from the root, its rule block and its WRS index lie in bounds,
+    // selectors address real fields and no node is reached twice
+    static bool Validate(const uint32_t* words, size_t count);
+    bool IsMapped() const { return mapped; }
+
+    ImageView View() const {
+        const uint32_t* words = published.load(std::memory_order_acquire);
+        return ImageView{words ? words : &emptyImage};
+    }
+
+    size_t SizeBytes() const { return used * sizeof(uint32_t); }
+    // Heap held by the image buffer; between updates lookups read the writer's buffer, and a
+    // mapped image is counted with its snapshot
+    size_t AllocatedBytes() const { return mapped ? 0 : HeapBytes(capacity * sizeof(uint32_t)); }
+    size_t SizeWords() const { return used; }
+
+private:
+    uint32_t* data = nullptr;                    // Writer's buffer, ahead of published mid-update
+    std::atomic<uint32_t*> published{nullptr};   // Buffer lookups read
+    size_t used = 0;
+    size_t capacity = 0;
+    size_t garbageWords = 0;
+    T2TreeNode* master = nullptr;
+    bool copyOnWrite = false;
+    bool mapped = false;
+
+    inline static const uint32_t emptyImage = 0;
+
+    static uint32_t BlockCapacity(size_t count);
+    static uint32_t BlockWords(uint32_t capacity) { return RuleBlock::Words(capacity); }
+    static uint32_t IndexCapacity(size_t words) { return static_cast<uint32_t>(words + words / 4); }
+    uint32_t NodeWords(const T2TreeNode* node, uint32_t* blockCapacity) const;
+
+    uint32_t Allocate(size_t words);
+    void Publish();
+
+    void refresh(T2TreeNode* node);
+    void StoreBounds(T2TreeNode* node);
+    void Commit();
+    uint32_t Append(T2TreeNode* node);
+    void WriteNode(const T2TreeNode* node, uint32_t offset, uint32_t blockCapacity);
+    void WriteBlock(uint32_t offset, const ArenaVector<Rule>& rules, uint32_t capacity);
+    void WriteIndex(uint32_t offset, const std::vector<uint32_t>& index, uint32_t capacity);
+    void Relink(T2TreeNode* node, uint32_t offset);
+    void RefreshWRS(T2TreeNode* node);
+
+    ImageInternalNode* InternalAt(uint32_t offset) { return reinterpret_cast<ImageInternalNode*>(data + offset); }
+    ImageLeafNode* LeafAt(uint32_t offset) { return reinterpret_cast<ImageLeafNode*>(data + offset); }
+    const RuleBlock* BlockAt(uint32_t offset) const { return reinterpret_cast<const RuleBlock*>(data + offset); }
+    TupleSpaceIndex IndexAt(uint32_t offset) const { return TupleSpaceIndex{data + offset}; }
+};
+
+#endif // COMPILED_T2_TREE_H
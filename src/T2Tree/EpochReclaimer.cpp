@@ -0,0 +1,114 @@
+#include "EpochReclaimer.h"
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+static constexpr uint64_t IDLE = UINT64_MAX;
+
+// One slot per reader thread, on its own cache line so readers never share a line
+struct alignas(64) ReaderSlot {
+    std::atomic<uint64_t> epoch{IDLE};
+    std::atomic<bool> claimed{false};
+};
+
+struct RetiredObject {
+    uint64_t epoch;
+    std::function<void()> release;
+};
+
+static ReaderSlot slots[EpochReclaimer::MAX_READERS];
+static std::atomic<int> slotHighWater{0};
+static std::atomic<uint64_t> globalEpoch{1};
+
+static std::mutex retireMutex;
+static std::vector<RetiredObject> retired;
+
+// Claims a reader slot on first use and hands it back when the thread exits
+struct ThreadSlot {
+    int index = -1;
+    int depth = 0;
+
+    ~ThreadSlot() {
+        if (index >= 0) {
+            slots[index].epoch.store(IDLE, std::memory_order_release);
+            slots[index].claimed.store(false, std::memory_order_release);
+        }
+    }
+
+    ReaderSlot& Get() {
+        if (index < 0) {
+            for (int i = 0; i < EpochReclaimer::MAX_READERS; i++) {
+                bool expected = false;
+                if (slots[i].claimed.compare_exchange_strong(expected, true)) {
+                    index = i;
+                    break;
+                }
+            }
+            if (index < 0) {
+                printf("EpochReclaimer: more than %d concurrent reader threads\n", EpochReclaimer::MAX_READERS);
+                exit(-1);
+            }
+            int high = slotHighWater.load();
+            while (high < index + 1 && !slotHighWater.compare_exchange_weak(high, index + 1)) {
+            }
+        }
+        return slots[index];
+    }
+};
+
+static thread_local ThreadSlot threadSlot;
+
+// ========== Readers ==========
+void EpochReclaimer::Enter() {
+    if (threadSlot.depth++ == 0) {
+        ReaderSlot& slot = threadSlot.Get();
+        slot.epoch.store(globalEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        // Order the announcement before any load of a published pointer
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+void EpochReclaimer::Exit() {
+    if (--threadSlot.depth == 0) {
+        slots[threadSlot.index].epoch.store(IDLE, std::memory_order_release);
+    }
+}
+
+// ========== Writers ==========
+static void ReclaimLocked() {
+    // Pairs with the fence in Enter: a reader either shows up here or sees the new pointers
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t oldestActive = IDLE;
+    int high = slotHighWater.load(std::memory_order_acquire);
+    for (int i = 0; i < high; i++) {
+        oldestActive = std::min(oldestActive, slots[i].epoch.load(std::memory_order_acquire));
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].epoch < oldestActive) {
+            retired[i].release();
+        } else {
+            retired[kept++] = std::move(retired[i]);
+        }
+    }
+    retired.resize(kept);
+}
+
+void EpochReclaimer::Retire(std::function<void()> release) {
+    std::lock_guard<std::mutex> lock(retireMutex);
+    retired.push_back({globalEpoch.fetch_add(1), std::move(release)});
+    ReclaimLocked();
+}
+
+void EpochReclaimer::Reclaim() {
+    std::lock_guard<std::mutex> lock(retireMutex);
+    ReclaimLocked();
+}
+
+size_t EpochReclaimer::Pending() {
+    std::lock_guard<std::mutex> lock(retireMutex);
+    return retired.size();
+}
@@ -0,0 +1,60 @@
+#ifndef EPOCH_RECLAIMER_H
+#define EPOCH_RECLAIMER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// Epoch-based reclamation for structures that lookups read without locks.
+//
+// A lookup holds an EpochGuard while it dereferences published pointers. A writer that
+// replaces a published structure hands the old one to Retire(); it is freed only once
+// every guard that could still see it has been released. Guards are per thread and may
+// nest; writers are expected to be serialized by the caller.
+class EpochReclaimer {
+public:
+    static constexpr int MAX_READERS = 256;
+
+    // Free `release` once no reader that started before this call is still running
+    static void Retire(std::function<void()> release);
+
+    // Free everything that is no longer reachable by any active reader
+    static void Reclaim();
+
+    // Objects retired but not yet freed
+    static size_t Pending();
+
+private:
+    friend class EpochGuard;
+    static void Enter();
+    static void Exit();
+};
+
+// Pins the current epoch for the calling thread for the guard's lifetime
+class EpochGuard {
+public:
+    EpochGuard() { EpochReclaimer::Enter(); }
+    ~EpochGuard() { EpochReclaimer::Exit(); }
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+// Loads and stores of the 32-bit links that updates swing in place
+inline uint32_t LoadLink(const uint32_t* link) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(link, __ATOMIC_ACQUIRE);
+#else
+    return *reinterpret_cast<const volatile uint32_t*>(link);
+#endif
+}
+
+inline void StoreLink(uint32_t* link, uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(link, value, __ATOMIC_RELEASE);
+#else
+    std::atomic_thread_fence(std::memory_order_release);
+    *reinterpret_cast<volatile uint32_t*>(link) = value;
+#endif
+}
+
+#endif // EPOCH_RECLAIMER_H
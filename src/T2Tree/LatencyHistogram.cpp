@@ -0,0 +1,49 @@
+#include "LatencyHistogram.h"
+#include <cmath>
+#include <thread>
+
+double LatencyClock::TicksPerNanosecond() {
+    static const double ticksPerNs = [] {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t first = Now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t last = Now();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<double>(last - first) / elapsed.count();
+    }();
+    return ticksPerNs;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (int b = 0; b < BUCKETS; b++) {
+        counts[b] += other.counts[b];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+uint64_t LatencyHistogram::BucketHigh(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t low = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return low + ((static_cast<uint64_t>(1) << shift) - 1);
+}
+
+uint64_t LatencyHistogram::Percentile(double fraction) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * count));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= rank) {
+            return std::min(BucketHigh(b), max);
+        }
+    }
+    return max;
+}
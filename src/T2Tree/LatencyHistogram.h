@@ -0,0 +1,73 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include "BitScan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Timestamps cheap enough to take around every lookup: the time-stamp counter where there
+// is one, steady_clock nanoseconds elsewhere
+struct LatencyClock {
+    static inline uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_lfence();  // Keep the read from drifting over the work being timed
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Ticks of Now() per nanosecond, measured against steady_clock on first use
+    static double TicksPerNanosecond();
+};
+
+// Latency histogram in the style of HdrHistogram. Values below SUB_BUCKETS have a bucket
+// each; above that every power of two is split into SUB_BUCKETS buckets, so any value is
+// known to within 1/SUB_BUCKETS (about 3%) whatever its size. Recording is a shift and an
+// increment into a fixed array. One instance per thread, merged afterwards.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    inline void Record(uint64_t ticks) {
+        counts[BucketOf(ticks)]++;
+        count++;
+        sum += ticks;
+        max = std::max(max, ticks);
+    }
+
+    void Merge(const LatencyHistogram& other);
+
+    uint64_t Count() const { return count; }
+    uint64_t Max() const { return max; }
+    double Mean() const { return count ? static_cast<double>(sum) / count : 0; }
+
+    // Smallest value that at least a `fraction` of the recorded values do not exceed, to
+    // bucket precision; 0 when empty
+    uint64_t Percentile(double fraction) const;
+
+private:
+    static inline int BucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<int>(value);
+        }
+        int shift = 63 - CountLeadingZeros64(value) - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<int>((value >> shift) & (SUB_BUCKETS - 1));
+    }
+    static uint64_t BucketHigh(int bucket);
+
+    std::array<uint64_t, BUCKETS> counts{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,155 @@
+// MatchKernels.cpp
+// First-match kernels over RuleBlock columns. The kernel is chosen once at startup from
+// the CPU features; every kernel returns exactly what the scalar loop returns.
+#include "PackedRuleBlock.h"
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define T2_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+typedef int (*FirstMatchKernel)(const RuleBlock& block, const PacketHeader& p, int currentBest);
+
+// ========== Scalar ==========
+static int FirstMatchScalar(const RuleBlock& block, const PacketHeader& p, int currentBest) {
+    const int32_t* priority = block.Priority();
+    const uint32_t *lo0 = block.Lo(0), *lo1 = block.Lo(1), *lo2 = block.Lo(2), *lo3 = block.Lo(3), *lo4 = block.Lo(4);
+    const uint32_t *hi0 = block.Hi(0), *hi1 = block.Hi(1), *hi2 = block.Hi(2), *hi3 = block.Hi(3), *hi4 = block.Hi(4);
+    const Point p0 = p[0], p1 = p[1], p2 = p[2], p3 = p[3], p4 = p[4];
+
+    for (uint32_t i = 0; i < block.count; i++) {
+        if (priority[i] <= currentBest) {
+            return -1;  // Subsequent rules have lower priority
+        }
+        if (p0 >= lo0[i] && p0 <= hi0[i] && p1 >= lo1[i] && p1 <= hi1[i] &&
+            p2 >= lo2[i] && p2 <= hi2[i] && p3 >= lo3[i] && p3 <= hi3[i] &&
+            p4 >= lo4[i] && p4 <= hi4[i]) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+#ifdef T2_X86_KERNELS
+// ========== AVX2: 8 rules per step ==========
+__attribute__((target("avx2")))
+static int FirstMatchAVX2(const RuleBlock& block, const PacketHeader& p, int currentBest) {
+    const int32_t* priority = block.Priority();
+    __m256i point[MAXDIMENSIONS];
+    for (int d = 0; d < MAXDIMENSIONS; d++) {
+        point[d] = _mm256_set1_epi32(static_cast<int>(p[d]));
+    }
+
+    // stride is a multiple of 8, so full vectors never leave the block
+    for (uint32_t base = 0; base < block.count; base += 8) {
+        if (priority[base] <= currentBest) {
+            return -1;
+        }
+        __m256i match = _mm256_set1_epi32(-1);
+        for (int d = 0; d < MAXDIMENSIONS; d++) {
+            __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block.Lo(d) + base));
+            __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block.Hi(d) + base));
+            // Unsigned p >= lo  <=>  max(p, lo) == p,   p <= hi  <=>  min(p, hi) == p
+            __m256i ge = _mm256_cmpeq_epi32(_mm256_max_epu32(point[d], lo), point[d]);
+            __m256i le = _mm256_cmpeq_epi32(_mm256_min_epu32(point[d], hi), point[d]);
+            match = _mm256_and_si256(match, _mm256_and_si256(ge, le));
+        }
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(match)));
+        if (mask) {
+            uint32_t i = base + static_cast<uint32_t>(__builtin_ctz(mask));
+            // Padding slots never match; a hit with too low a priority ends the scan
+            return (i < block.count && priority[i] > currentBest) ? static_cast<int>(i) : -1;
+        }
+    }
+    return -1;
+}
+
+// ========== AVX-512: 16 rules per step ==========
+__attribute__((target("avx512f")))
+static int FirstMatchAVX512(const RuleBlock& block, const PacketHeader& p, int currentBest) {
+    const int32_t* priority = block.Priority();
+    __m512i point[MAXDIMENSIONS];
+    for (int d = 0; d < MAXDIMENSIONS; d++) {
+        point[d] = _mm512_set1_epi32(static_cast<int>(p[d]));
+    }
+
+    for (uint32_t base = 0; base < block.count; base += 16) {
+        if (priority[base] <= currentBest) {
+            return -1;
+        }
+        uint32_t valid = block.count - base < 16 ? block.count - base : 16;
+        __mmask16 match = static_cast<__mmask16>((1u << valid) - 1);
+        for (int d = 0; d < MAXDIMENSIONS && match; d++) {
+            __m512i lo = _mm512_maskz_loadu_epi32(match, block.Lo(d) + base);
+            __m512i hi = _mm512_maskz_loadu_epi32(match, block.Hi(d) + base);
+            match = _mm512_mask_cmp_epu32_mask(match, point[d], lo, _MM_CMPINT_NLT);
+            match = _mm512_mask_cmp_epu32_mask(match, point[d], hi, _MM_CMPINT_LE);
+        }
+        if (match) {
+            uint32_t i = base + static_cast<uint32_t>(__builtin_ctz(match));
+            return priority[i] > currentBest ? static_cast<int>(i) : -1;
+        }
+    }
+    return -1;
+}
+#endif
+
+// ========== Dispatch ==========
+struct KernelEntry {
+    const char* name;
+    FirstMatchKernel kernel;
+    bool (*supported)();
+};
+
+static bool AlwaysSupported() { return true; }
+
+#ifdef T2_X86_KERNELS
+static bool SupportsAVX2() { return __builtin_cpu_supports("avx2"); }
+static bool SupportsAVX512() { return __builtin_cpu_supports("avx512f"); }
+#endif
+
+// Ordered from most to least preferred
+static const KernelEntry kernels[] = {
+#ifdef T2_X86_KERNELS
+    {"avx512", FirstMatchAVX512, SupportsAVX512},
+    {"avx2", FirstMatchAVX2, SupportsAVX2},
+#endif
+    {"scalar", FirstMatchScalar, AlwaysSupported},
+};
+
+static const KernelEntry* PickBestKernel() {
+#ifdef T2_X86_KERNELS
+    __builtin_cpu_init();  // Runs during static initialisation, before libgcc's constructor
+#endif
+    for (const KernelEntry& entry : kernels) {
+        if (entry.supported()) {
+            return &entry;
+        }
+    }
+    return &kernels[sizeof(kernels) / sizeof(kernels[0]) - 1];
+}
+
+static const KernelEntry* activeKernel = PickBestKernel();
+
+int RuleBlock::FirstMatch(const PacketHeader& p, int currentBest) const {
+    return activeKernel->kernel(*this, p, currentBest);
+}
+
+const char* ActiveMatchKernel() {
+    return activeKernel->name;
+}
+
+bool SelectMatchKernel(const char* name) {
+    if (strcmp(name, "auto") == 0) {
+        activeKernel = PickBestKernel();
+        return true;
+    }
+    for (const KernelEntry& entry : kernels) {
+        if (strcmp(entry.name, name) == 0 && entry.supported()) {
+            activeKernel = &entry;
+            return true;
+        }
+    }
+    return false;
+}
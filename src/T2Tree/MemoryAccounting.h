@@ -0,0 +1,31 @@
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <vector>
+#include <cstddef>
+
+// Heap bytes one malloc of `bytes` really takes: glibc adds an 8-byte header, rounds to
+// 16 bytes and never hands out less than 32. 0 for no allocation.
+inline size_t HeapBytes(size_t bytes) {
+    if (bytes == 0) {
+        return 0;
+    }
+    size_t chunk = (bytes + sizeof(size_t) + 15) & ~static_cast<size_t>(15);
+    return chunk < 32 ? 32 : chunk;
+}
+
+// Heap bytes behind a std::vector (its capacity, not its size)
+template <typename T, typename Alloc>
+size_t VectorBytes(const std::vector<T, Alloc>& v) {
+    return HeapBytes(v.capacity() * sizeof(T));
+}
+
+// Heap bytes of a node-based std::unordered_map/set: one node per entry (next pointer plus
+// the value) and the bucket array
+template <typename Table>
+size_t HashTableBytes(const Table& table) {
+    return table.size() * HeapBytes(sizeof(void*) + sizeof(typename Table::value_type)) +
+           HeapBytes(table.bucket_count() * sizeof(void*));
+}
+
+#endif // MEMORY_ACCOUNTING_H
@@ -0,0 +1,55 @@
+#include "NodeBitStatistics.h"
+#include <algorithm>
+
+NodeBitStatistics::NodeBitStatistics(const Rule* rules, size_t count)
+    : nrules(count), care(count * MAXDIMENSIONS), value(count * MAXDIMENSIONS) {
+    for (size_t r = 0; r < count; r++) {
+        const Rule& rule = rules[r];
+        for (int f = 0; f < MAXDIMENSIONS; f++) {
+            int prefix = std::min(static_cast<int>(rule.prefix_length[f]), width[f]);
+            if (prefix == 0) {
+                continue;
+            }
+            uint32_t fieldMask = width[f] == 32 ? ~0u : ((1u << width[f]) - 1);
+            uint32_t fixed = (fieldMask << (width[f] - prefix)) & fieldMask;
+            uint32_t bits = rule.range[f][LowDim] & rule.range[f][HighDim] & fixed;
+            care[r * MAXDIMENSIONS + f] = fixed;
+            value[r * MAXDIMENSIONS + f] = bits;
+
+            for (int b = 0; b < prefix; b++) {
+                if (bits & (1u << (width[f] - 1 - b))) {
+                    ones[f][b]++;
+                } else {
+                    zeros[f][b]++;
+                }
+            }
+        }
+    }
+}
+
+std::vector<int> NodeBitStatistics::SelectBits(const int* left, const std::vector<int>& opt) const {
+    std::vector<int> cursor(left, left + MAXDIMENSIONS);
+    std::vector<int> bit;
+
+    for (int field : opt) {
+        if (field == -1) {
+            bit.push_back(-1);
+            continue;
+        }
+        // Advance past bits every rule agrees on; stop at the first bit that splits the
+        // rules, or give up (-1) at a bit no rule fixes
+        while (true) {
+            int b = cursor[field];
+            if (b < 0 || b >= width[field] || (zeros[field][b] == 0 && ones[field][b] == 0)) {
+                cursor[field] = -1;
+                break;
+            }
+            if (zeros[field][b] > 0 && ones[field][b] > 0) {
+                break;
+            }
+            cursor[field]++;
+        }
+        bit.push_back(cursor[field]++);
+    }
+    return bit;
+}
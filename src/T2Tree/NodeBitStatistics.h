@@ -0,0 +1,57 @@
+#ifndef NODE_BIT_STATISTICS_H
+#define NODE_BIT_STATISTICS_H
+
+#include "../ElementaryClasses.h"
+#include <vector>
+#include <cstdint>
+
+#define NODE_BIT_MAX_WIDTH 32
+
+// Construction-time statistics of one node's rules, gathered in a single sweep: how many
+// rules fix each (field, bit) to 0 and to 1 (the rest are wildcards there), plus every
+// rule's fixed bits as care/value masks. Bit selection then runs from the counts and
+// partition scoring from the masks, instead of calling Rule::Getbit per rule and bit.
+class NodeBitStatistics {
+public:
+    NodeBitStatistics(const Rule* rules, size_t count);
+
+    int Zeros(int field, int bit) const { return zeros[field][bit]; }
+    int Ones(int field, int bit) const { return ones[field][bit]; }
+
+    // Selected bit per opt entry, starting from the node's `left` cursors (MAXDIMENSIONS of
+    // them): the first bit of each field that splits the rules, -1 once a bit is a wildcard
+    // for every rule
+    std::vector<int> SelectBits(const int* left, const std::vector<int>& opt) const;
+
+    // Child index of rule r for (opt, bit), -1 if the rule is a wildcard on a selected bit.
+    // Matches T2Tree::CalculateLocation for the rule at the same index in the constructor input
+    int Location(size_t r, const std::vector<int>& opt, const std::vector<int>& bit) const {
+        const uint32_t* c = &care[r * MAXDIMENSIONS];
+        const uint32_t* v = &value[r * MAXDIMENSIONS];
+        int loc = 0;
+        for (size_t i = 0; i < opt.size(); i++) {
+            if (opt[i] == -1 || bit[i] == -1) {
+                continue;
+            }
+            uint32_t mask = 1u << (width[opt[i]] - 1 - bit[i]);
+            if (!(c[opt[i]] & mask)) {
+                return -1;
+            }
+            loc = (loc << 1) + ((v[opt[i]] & mask) ? 1 : 0);
+        }
+        return loc;
+    }
+
+    size_t size() const { return nrules; }
+
+    static constexpr int width[MAXDIMENSIONS] = {32, 32, 16, 16, 8};
+
+private:
+    size_t nrules;
+    int zeros[MAXDIMENSIONS][NODE_BIT_MAX_WIDTH] = {};
+    int ones[MAXDIMENSIONS][NODE_BIT_MAX_WIDTH] = {};
+    std::vector<uint32_t> care;   // MAXDIMENSIONS words per rule, bit (width - 1 - b) set if bit b is fixed
+    std::vector<uint32_t> value;  // Fixed bit values under care
+};
+
+#endif // NODE_BIT_STATISTICS_H
@@ -0,0 +1,27 @@
+#include "PackedRuleBlock.h"
+
+// ========== RuleBlock ==========
+void RuleBlock::Write(uint32_t* dst, uint32_t stride, const Rule* rules, size_t count) {
+    std::vector<const Rule*> pointers(count);
+    for (size_t i = 0; i < count; i++) {
+        pointers[i] = &rules[i];
+    }
+    Write(dst, stride, pointers.data(), pointers.size());
+}
+
+void RuleBlock::Write(uint32_t* dst, uint32_t stride, const Rule* const* rules, size_t count) {
+    dst[0] = static_cast<uint32_t>(count);
+    dst[1] = stride;
+
+    uint32_t* columns = dst + 2;
+    for (uint32_t i = 0; i < stride; i++) {
+        const Rule* rule = i < count ? rules[i] : nullptr;
+        for (int d = 0; d < MAXDIMENSIONS; d++) {
+            // Unused slots get an empty range so they never match
+            columns[d * stride + i] = rule ? rule->range[d][LowDim] : 0xFFFFFFFF;
+            columns[(MAXDIMENSIONS + d) * stride + i] = rule ? rule->range[d][HighDim] : 0;
+        }
+        columns[2 * MAXDIMENSIONS * stride + i] = static_cast<uint32_t>(rule ? rule->priority : -1);
+        columns[(2 * MAXDIMENSIONS + 1) * stride + i] = static_cast<uint32_t>(rule ? rule->id : -1);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef PACKED_RULE_BLOCK_H
+#define PACKED_RULE_BLOCK_H
+
+#include "../ElementaryClasses.h"
+#include <vector>
+#include <cstdint>
+
+#define RULE_BLOCK_COLUMNS (2 * MAXDIMENSIONS + 2)
+#define RULE_BLOCK_ALIGN 8
+
+// Structure-of-arrays rule block. The header is followed by RULE_BLOCK_COLUMNS columns of
+// `stride` words each: lo[0..4], hi[0..4], priority, id. Rules are sorted by priority in
+// descending order and slots past count never match. Compiled tree images and tuple-space
+// indexes embed blocks in this layout.
+struct RuleBlock {
+    uint32_t count;
+    uint32_t stride;
+
+    const uint32_t* Lo(int field) const { return Column(field); }
+    const uint32_t* Hi(int field) const { return Column(MAXDIMENSIONS + field); }
+    const int32_t* Priority() const { return reinterpret_cast<const int32_t*>(Column(2 * MAXDIMENSIONS)); }
+    const int32_t* Id() const { return reinterpret_cast<const int32_t*>(Column(2 * MAXDIMENSIONS + 1)); }
+
+    // Index of the first (highest priority) rule matching p, -1 if none beats currentBest.
+    // Runs the kernel selected for this CPU (see MatchKernels.cpp)
+    int FirstMatch(const PacketHeader& p, int currentBest) const;
+
+    // Write a block with room for stride rules at dst
+    static void Write(uint32_t* dst, uint32_t stride, const Rule* rules, size_t count);
+    static void Write(uint32_t* dst, uint32_t stride, const Rule* const* rules, size_t count);
+
+    static uint32_t StrideFor(size_t capacity) {
+        return static_cast<uint32_t>((capacity + RULE_BLOCK_ALIGN - 1) & ~static_cast<size_t>(RULE_BLOCK_ALIGN - 1));
+    }
+    static uint32_t Words(uint32_t stride) { return 2 + RULE_BLOCK_COLUMNS * stride; }
+
+private:
+    const uint32_t* Column(int c) const { return reinterpret_cast<const uint32_t*>(this + 1) + c * stride; }
+};
+
+// Matching kernel in use: "avx512", "avx2" or "scalar"
+const char* ActiveMatchKernel();
+
+// Force a kernel by name ("auto" restores the default); false if unknown or unsupported
+bool SelectMatchKernel(const char* name);
+
+#endif // PACKED_RULE_BLOCK_H
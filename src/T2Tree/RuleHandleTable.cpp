@@ -0,0 +1,46 @@
+#include "RuleHandleTable.h"
+#include "MemoryAccounting.h"
+
+RuleHandleTable::Location& RuleHandleTable::at(int id) {
+    auto it = handleOf.find(id);
+    if (it != handleOf.end()) {
+        return slots[it->second];
+    }
+
+    uint32_t handle;
+    if (!freeHandles.empty()) {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+        slots[handle] = Location();
+    } else {
+        handle = static_cast<uint32_t>(slots.size());
+        slots.emplace_back();
+    }
+    handleOf.emplace(id, handle);
+    return slots[handle];
+}
+
+void RuleHandleTable::erase(int id) {
+    auto it = handleOf.find(id);
+    if (it == handleOf.end()) {
+        return;
+    }
+    slots[it->second] = Location();
+    freeHandles.push_back(it->second);
+    handleOf.erase(it);
+}
+
+void RuleHandleTable::clear() {
+    handleOf.clear();
+    slots.clear();
+    freeHandles.clear();
+}
+
+void RuleHandleTable::reserve(size_t rules) {
+    handleOf.reserve(rules);
+    slots.reserve(rules);
+}
+
+size_t RuleHandleTable::memoryUsage() const {
+    return HashTableBytes(handleOf) + VectorBytes(slots) + VectorBytes(freeHandles);
+}
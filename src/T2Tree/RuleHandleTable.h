@@ -0,0 +1,66 @@
+#ifndef RULE_HANDLE_TABLE_H
+#define RULE_HANDLE_TABLE_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+
+struct T2TreeNode;
+
+// Where each rule of the classifier lives, by rule id. Ids are remapped to dense handles
+// the first time they are seen, so any 32-bit id can be indexed and the table grows with
+// the number of rules held, not with the range of their ids. Handles of erased rules are
+// reused. A lookup is one hash probe plus one array access, whatever the id.
+class RuleHandleTable {
+public:
+    static constexpr int NO_TREE = -1;
+    static constexpr int OVERFLOW_TREE = INT_MAX;  // The rule is in the overflow container
+
+    struct Location {
+        int tree = NO_TREE;          // Tree index, OVERFLOW_TREE, or NO_TREE while unplaced
+        T2TreeNode* node = nullptr;  // Leaf holding a tree rule, or the node whose WRS has it
+    };
+
+    // Location of id, nullptr if the table does not hold it
+    Location* find(int id) {
+        auto it = handleOf.find(id);
+        return it == handleOf.end() ? nullptr : &slots[it->second];
+    }
+    const Location* find(int id) const {
+        auto it = handleOf.find(id);
+        return it == handleOf.end() ? nullptr : &slots[it->second];
+    }
+
+    // Location of id, added unplaced if the table does not hold it yet
+    Location& at(int id);
+
+    void erase(int id);
+    void clear();
+    void reserve(size_t rules);
+    size_t size() const { return handleOf.size(); }
+
+    // Visit every (id, location) pair; the location may be changed in place
+    template <typename Visit>
+    void forEach(Visit visit) {
+        for (const auto& entry : handleOf) {
+            visit(entry.first, slots[entry.second]);
+        }
+    }
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (const auto& entry : handleOf) {
+            visit(entry.first, static_cast<const Location&>(slots[entry.second]));
+        }
+    }
+
+    size_t memoryUsage() const;
+
+private:
+    std::unordered_map<int, uint32_t> handleOf;  // Rule id -> handle
+    std::vector<Location> slots;                 // By handle
+    std::vector<uint32_t> freeHandles;
+};
+
+#endif // RULE_HANDLE_TABLE_H
@@ -4,6 +4,9 @@
 #include <iomanip>
 #include <algorithm>
 #include <unordered_map>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // Add auxiliary function to calculate rule access count based on cache line
 inline int CalculateRuleAccess(int numRules) {
@@ -13,170 +16,231 @@ inline int CalculateRuleAccess(int numRules) {
 }
 
 // ========== HybridOverflowContainer Implementation ==========
-void HybridOverflowContainer::insert(const Rule& rule) {
-    int layerIdx = rule.priority / LAYER_SIZE;
-    
-    if (layerIdx >= static_cast<int>(layers.size())) {
-        layers.resize(layerIdx + 1, 
-            PriorityLayer(layerIdx * LAYER_SIZE, (layerIdx + 1) * LAYER_SIZE - 1));
+HybridOverflowContainer::HybridOverflowContainer() : published(new View()) {
+}
+
+HybridOverflowContainer::~HybridOverflowContainer() {
+    const View* old = published.load(std::memory_order_relaxed);
+    EpochReclaimer::Retire([old]() { delete old; });
+}
+
+HybridOverflowContainer::TupleMask HybridOverflowContainer::maskOf(const Rule& rule) {
+    TupleMask mask;
+    for (int d = 0; d < MAXDIMENSIONS; d++) {
+        mask[d] = TupleSpaceIndex::FieldMask(rule, d);
     }
-    
-    layers[layerIdx].rules.push_back(rule);
-    layers[layerIdx].maxPriority = std::max(layers[layerIdx].maxPriority, rule.priority);
-    layers[layerIdx].sorted = false;
-    
-    ruleIdToLayer[rule.id] = layerIdx;
+    return mask;
+}
+
+void HybridOverflowContainer::insert(const Rule& rule) {
+    if (ruleIdToTuple.count(rule.id)) {
+        remove(rule.id);  // Re-inserting an id replaces the rule, slots stay one per id
+    }
+    // Rules whose tuple has no group of its own yet share the catch-all group (mask 0);
+    // optimize() gives tuples their own group once they are large enough
+    TupleMask mask = maskOf(rule);
+    if (tuples.find(mask) == tuples.end()) {
+        mask = TupleMask{};
+    }
+    TupleGroup& group = tuples[mask];
+    
+    ruleIdToTuple[rule.id] = RuleSlot{mask, group.rules.size()};
+    group.rules.push_back(rule);
+    group.maxPriority = std::max(group.maxPriority, rule.priority);
+    group.dirty = true;
+    stale = true;
+    ruleCount++;
+    changeCount++;
 }
 
 bool HybridOverflowContainer::remove(int rule_id) {
-    auto it = ruleIdToLayer.find(rule_id);
-    if (it == ruleIdToLayer.end()) {
+    auto it = ruleIdToTuple.find(rule_id);
+    if (it == ruleIdToTuple.end()) {
         return false;
     }
     
-    size_t layerIdx = it->second;
-    if (layerIdx >= layers.size()) {
+    auto groupIt = tuples.find(it->second.mask);
+    if (groupIt == tuples.end()) {
         return false;
     }
     
-    auto& layer = layers[layerIdx];
-    auto ruleIt = std::find_if(layer.rules.begin(), layer.rules.end(),
-        [rule_id](const Rule& r) { return r.id == rule_id; });
+    // Group order does not matter (the index sorts its buckets), so the hole is filled with
+    // the group's last rule
+    TupleGroup& group = groupIt->second;
+    size_t slot = it->second.slot;
+    int priority = group.rules[slot].priority;
+    if (slot + 1 != group.rules.size()) {
+        group.rules[slot] = std::move(group.rules.back());
+        ruleIdToTuple[group.rules[slot].id].slot = slot;
+    }
+    group.rules.pop_back();
+    group.dirty = true;
+    stale = true;
     
-    if (ruleIt != layer.rules.end()) {
-        layer.rules.erase(ruleIt);
-        layer.sorted = false;
-        
-        if (layer.rules.empty()) {
-            layer.maxPriority = -1;
-        } else {
-            layer.maxPriority = std::max_element(layer.rules.begin(), layer.rules.end(),
-                [](const Rule& a, const Rule& b) { return a.priority < b.priority; })->priority;
+    if (priority >= group.maxPriority) {
+        group.maxPriority = -1;
+        for (const Rule& r : group.rules) {
+            group.maxPriority = std::max(group.maxPriority, r.priority);
         }
-        
-        ruleIdToLayer.erase(it);
-        return true;
     }
     
-    return false;
+    ruleIdToTuple.erase(it);
+    ruleCount--;
+    changeCount++;
+    return true;
 }
 
-int HybridOverflowContainer::search(const Packet& packet, int currentBest) const {
+int HybridOverflowContainer::View::search(const PacketHeader& packet, int currentBest) const {
     int bestPriority = currentBest;
     
-    // Search from high priority layers to low priority layers
-    for (int i = static_cast<int>(layers.size()) - 1; i >= 0; i--) {
-        const auto& layer = layers[i];
-        
-        // Layer pruning
-        if (layer.rules.empty() || layer.maxPriority <= bestPriority) {
-            continue;
-        }
-        
-        // Ensure layer is sorted
-        if (!layer.sorted) {
-            auto& mutableLayer = const_cast<PriorityLayer&>(layer);
-            std::sort(mutableLayer.rules.begin(), mutableLayer.rules.end(),
-                [](const Rule& a, const Rule& b) { return a.priority > b.priority; });
-            mutableLayer.sorted = true;
+    for (const TupleSpaceIndex& layer : layers) {
+        // Layers are ordered by max priority, so nothing after this one can win either
+        if (layer.MaxPriority() <= bestPriority) {
+            break;
         }
         
-        // Search rules within layer (rules are sorted by priority in descending order)
-        for (const auto& rule : layer.rules) {
-            if (rule.priority <= bestPriority) {
-                break;  // Subsequent rules have lower priority
-            }
-            
-            if (rule.MatchesPacket(packet)) {
-                bestPriority = rule.priority;
-                break;  // Found the highest priority match in this layer
-            }
-        }
+        // Only the packet's own bucket in the tuple is checked
+        bestPriority = layer.Search(packet, bestPriority);
     }
     
     return bestPriority;
 }
 
-size_t HybridOverflowContainer::size() const {
-    size_t total = 0;
-    for (const auto& layer : layers) {
-        total += layer.rules.size();
+void HybridOverflowContainer::clear() {
+    tuples.clear();
+    ruleIdToTuple.clear();
+    ruleCount = 0;
+    changeCount++;
+    stale = true;
+}
+
+void HybridOverflowContainer::collectRules(std::vector<Rule>& rules) const {
+    for (const auto& tuple : tuples) {
+        rules.insert(rules.end(), tuple.second.rules.begin(), tuple.second.rules.end());
     }
-    return total;
 }
 
-void HybridOverflowContainer::clear() {
-    layers.clear();
-    ruleIdToLayer.clear();
+const Rule* HybridOverflowContainer::find(int rule_id) const {
+    auto it = ruleIdToTuple.find(rule_id);
+    if (it == ruleIdToTuple.end()) {
+        return nullptr;
+    }
+    auto groupIt = tuples.find(it->second.mask);
+    return groupIt == tuples.end() ? nullptr : &groupIt->second.rules[it->second.slot];
 }
 
-Memory HybridOverflowContainer::memoryUsage() const {
-    Memory mem = 0;
-    
-    for (const auto& layer : layers) {
-        mem += static_cast<Memory>(layer.rules.size() * sizeof(Rule));
-        mem += sizeof(PriorityLayer);
+size_t HybridOverflowContainer::layerMemoryUsage() const {
+    // A std::map node carries three pointers and a color word ahead of its value
+    size_t mem = 0;
+    for (const auto& tuple : tuples) {
+        mem += HeapBytes(4 * sizeof(void*) + sizeof(tuple));
+        mem += VectorBytes(tuple.second.rules);
+        if (tuple.second.index) {
+            // make_shared puts the vector next to its two reference counts
+            mem += HeapBytes(2 * sizeof(void*) + sizeof(std::vector<uint32_t>)) + VectorBytes(*tuple.second.index);
+        }
     }
     
-    mem += static_cast<Memory>(ruleIdToLayer.size() * (sizeof(int) + sizeof(size_t)));
-    
+    const View* current = view();
+    mem += HeapBytes(sizeof(View)) + VectorBytes(current->layers) + VectorBytes(current->owners);
     return mem;
 }
 
+size_t HybridOverflowContainer::idIndexMemoryUsage() const {
+    return HashTableBytes(ruleIdToTuple);
+}
+
 void HybridOverflowContainer::optimize() {
-    std::vector<Rule> allRules;
+    // Regroup: tuples with enough rules get their own hashed group, the rest are scanned
+    // together in the catch-all group
+    std::map<TupleMask, std::vector<Rule>> natural;
+    for (auto& tuple : tuples) {
+        for (Rule& rule : tuple.second.rules) {
+            natural[maskOf(rule)].push_back(std::move(rule));
+        }
+    }
     
-    for (auto& layer : layers) {
-        allRules.insert(allRules.end(), layer.rules.begin(), layer.rules.end());
+    tuples.clear();
+    ruleIdToTuple.clear();
+    for (auto& tuple : natural) {
+        TupleMask mask = tuple.second.size() >= MIN_TUPLE_RULES ? tuple.first : TupleMask{};
+        TupleGroup& group = tuples[mask];
+        for (Rule& rule : tuple.second) {
+            group.maxPriority = std::max(group.maxPriority, rule.priority);
+            ruleIdToTuple[rule.id] = RuleSlot{mask, group.rules.size()};
+            group.rules.push_back(std::move(rule));
+        }
     }
+    stale = true;
+}
+
+void HybridOverflowContainer::publish() {
+    if (!stale) return;
     
-    if (allRules.empty()) return;
+    // Only changed tuples are re-indexed; the others are shared with the previous view
+    for (auto it = tuples.begin(); it != tuples.end();) {
+        TupleGroup& group = it->second;
+        if (group.rules.empty()) {
+            it = tuples.erase(it);
+            continue;
+        }
+        if (group.dirty || !group.index) {
+            auto words = std::make_shared<std::vector<uint32_t>>();
+            TupleSpaceIndex::Build(group.rules, *words, it->first.data());
+            group.index = words;
+            group.dirty = false;
+        }
+        ++it;
+    }
     
-    std::sort(allRules.begin(), allRules.end(),
-        [](const Rule& a, const Rule& b) { return a.priority > b.priority; });
+    std::vector<const TupleGroup*> order;
+    for (const auto& tuple : tuples) {
+        order.push_back(&tuple.second);
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [](const TupleGroup* a, const TupleGroup* b) { return a->maxPriority > b->maxPriority; });
     
-    // Re-layer
-    int numLayers = std::min(10, std::max(1, static_cast<int>(allRules.size()) / 100));
-    int rulesPerLayer = static_cast<int>(allRules.size()) / numLayers;
+    View* fresh = new View();
+    for (const TupleGroup* group : order) {
+        fresh->layers.push_back(TupleSpaceIndex{group->index->data()});
+        fresh->owners.push_back(group->index);
+    }
+    fresh->size = size();
+    fresh->maxPriority = getMaxPriority();
     
-    layers.clear();
-    ruleIdToLayer.clear();
+    const View* old = published.exchange(fresh, std::memory_order_acq_rel);
+    EpochReclaimer::Retire([old]() { delete old; });
+    stale = false;
+}
+
+void HybridOverflowContainer::publishMapped(const std::vector<TupleSpaceIndex>& indexes, size_t size,
+                                            int maxPriority) {
+    View* fresh = new View();
+    fresh->layers = indexes;
+    fresh->size = size;
+    fresh->maxPriority = maxPriority;
     
-    for (size_t i = 0; i < allRules.size(); i++) {
-        int layerIdx = std::min(static_cast<int>(i / rulesPerLayer), numLayers - 1);
-        
-        if (layerIdx >= static_cast<int>(layers.size())) {
-            layers.emplace_back();
-        }
-        
-        layers[layerIdx].rules.push_back(allRules[i]);
-        layers[layerIdx].maxPriority = std::max(layers[layerIdx].maxPriority, allRules[i].priority);
-        layers[layerIdx].minPriority = std::min(layers[layerIdx].minPriority, allRules[i].priority);
-        layers[layerIdx].sorted = true;
-        
-        ruleIdToLayer[allRules[i].id] = layerIdx;
-    }
+    const View* old = published.exchange(fresh, std::memory_order_acq_rel);
+    EpochReclaimer::Retire([old]() { delete old; });
+    stale = false;
 }
 
 int HybridOverflowContainer::getMaxPriority() const {
     int maxPri = -1;
-    for (const auto& layer : layers) {
-        if (!layer.rules.empty()) {
-            maxPri = std::max(maxPri, layer.maxPriority);
-        }
+    for (const auto& tuple : tuples) {
+        maxPri = std::max(maxPri, tuple.second.maxPriority);
     }
     return maxPri;
 }
 
 // ========== T2Tree Constructor and Destructor ==========
 T2Tree::T2Tree(int maxBits, int maxLevel, int binth, int maxTreeNum, int wrsThreshold) 
-    : normalTreeCount(0), maxRuleId(0), overflowMaxPriority(-1) {
+    : normalTreeCount(0), overflowMaxPriority(-1) {
     this->maxBits = maxBits;
     this->maxLevel = maxLevel;
     this->binth = binth;
     this->maxTreeNum = maxTreeNum;
     this->wrsThreshold = wrsThreshold;
-    this->Query = 0;
 
     partitionOpt.resize(6);
     for (int i = -1; i < 5; i++) {
@@ -197,26 +261,38 @@ T2Tree::T2Tree(int maxBits, int maxLevel, int binth, int maxTreeNum, int wrsThre
 }
 
 T2Tree::~T2Tree() {
-    // Only delete normal trees
-    for (int i = 0; i < normalTreeCount; i++) {
-        delete roots[i];
+    StopBackgroundRebuild();
+    const SearchOrder* order = treeSearchOrder.load(std::memory_order_relaxed);
+    EpochReclaimer::Retire([order]() { delete order; });
+    
+    // Only delete normal trees (a loaded snapshot has no master trees)
+    for (size_t i = 0; i < roots.size() && static_cast<int>(i) < normalTreeCount; i++) {
+        T2TreeNode::FreeTree(roots[i]);
     }
+    releaseSnapshot();
+}
+
+bool T2Tree::rejectUpdate() const {
+    if (snapshotBase) {
+        printf("T2Tree: instance loaded from a snapshot is lookup-only, update ignored\n");
+        return true;
+    }
+    return false;
 }
 
 // ========== Build Classifier ==========
 void T2Tree::ConstructClassifier(const std::vector<Rule>& rules) {
-    this->classifier = rules;
+    if (rejectUpdate()) return;
+    std::lock_guard<std::mutex> lock(updateMutex);
+    constructions++;
     std::vector<Rule> currRules = rules;
     std::vector<Rule> kickedRules;
     
     size_t initialRuleCount = rules.size();
     
     // Pre-allocate index space
-    maxRuleId = 0;
-    for (const auto& rule : rules) {
-        maxRuleId = std::max(maxRuleId, rule.id);
-    }
-    ruleTreeIndex.resize(maxRuleId + 1, -1);
+    ruleIndex.clear();
+    ruleIndex.reserve(rules.size());
     
     // Sort rules
     std::sort(currRules.begin(), currRules.end(), 
@@ -235,27 +311,24 @@ void T2Tree::ConstructClassifier(const std::vector<Rule>& rules) {
         Maxpri.push_back(-1);
 
         int currentTreeIndex = static_cast<int>(roots.size());
-        int dynamicBinth = getBalancedAggressiveLeafCapacity(static_cast<int>(currRules.size()), currentTreeIndex);
-        
-        int originalBinth = this->binth;
-        this->binth = dynamicBinth;
-        
-        T2TreeNode* node = CreateSubT2TreeBalancedOptimized(currRules, kickedRules, currentTreeIndex);
+        T2TreeNode* node = buildTree(currRules, kickedRules, currentTreeIndex);
         roots.push_back(node);
         
         // Fix: Recalculate the actual maximum priority of this tree
-        Maxpri.back() = recalculateTreeMaxPriority(node);
+        Maxpri.back() = node ? node->maxSubtreePriority : -1;
         
         // Record rule positions
+        std::unordered_set<int> kickedIds;
+        for (const auto& rule : kickedRules) {
+            kickedIds.insert(rule.id);
+        }
         for (const auto& rule : currRules) {
-            bool isKicked = std::find_if(kickedRules.begin(), kickedRules.end(),
-                [&rule](const Rule& r) { return r.id == rule.id; }) != kickedRules.end();
-            if (!isKicked && rule.id <= maxRuleId) {
-                ruleTreeIndex[rule.id] = currentTreeIndex;
+            bool isKicked = kickedIds.count(rule.id) != 0;
+            if (!isKicked) {
+                ruleIndex.at(rule.id).tree = currentTreeIndex;
             }
         }
         
-        this->binth = originalBinth;
         currRules = kickedRules;
         SortRules(currRules);
     }
@@ -272,9 +345,7 @@ void T2Tree::ConstructClassifier(const std::vector<Rule>& rules) {
         
         for (const auto& rule : currRules) {
             hybridOverflowContainer.insert(rule);
-            if (rule.id <= maxRuleId) {
-                ruleTreeIndex[rule.id] = 127;  // 127 indicates overflow
-            }
+            ruleIndex.at(rule.id).tree = OVERFLOW_TREE;
         }
         
         // Fix: Record maximum priority of overflow container
@@ -297,72 +368,235 @@ void T2Tree::ConstructClassifier(const std::vector<Rule>& rules) {
         performBalancedTreeMerging();
     }
     
+    for (int i = 0; i < normalTreeCount; i++) {
+        indexTreeRules(roots[i]);
+    }
+    compileSearchImages();
     buildTreeSearchOrder();
     
     if (hybridOverflowContainer.size() > 1000) {
         hybridOverflowContainer.optimize();
         overflowMaxPriority = hybridOverflowContainer.getMaxPriority();  // Update maximum priority
     }
+    hybridOverflowContainer.publish();
+    
+    treeVersion.assign(normalTreeCount, 0);
+    recordBuiltHealth();
 }
 
 // ========== Packet Classification ==========
-int T2Tree::ClassifyAPacket(const Packet& packet) {
+int T2Tree::ClassifyAPacket(const PacketHeader& packet) {
+    EpochGuard guard;
+    uint64_t query = 0;
+    int priority = classify(packet, query);
+    QueryUpdate(query);  // Update statistics
+    return priority;
+}
+
+int T2Tree::Classify(const PacketHeader& packet, LookupStats& stats) const {
+    EpochGuard guard;
+    uint64_t query = 0;
+    int priority = classify(packet, query);
+    stats.Record(query);
+    return priority;
+}
+
+// Read-only search shared by all lookup entry points; query receives the access count.
+// Trees are visited in descending Maxpri order, and the overflow container is searched at
+// its own place in that order, so the search ends at the first source whose best priority
+// cannot beat the match found so far.
+int T2Tree::classify(const PacketHeader& packet, uint64_t& query) const {
     int globalBestPriority = -1;
-    Query = 0;  // Reset query counter
-    
-    // Optimize search strategy
-    bool searchedOverflow = false;
-    if (hybridOverflowContainer.size() > 0 && overflowMaxPriority > 80000) {
-        // Overflow container access: 1 time + cache line based rule access
-        Query++;  
-        int numOverflowRules = static_cast<int>(hybridOverflowContainer.size());
-        // Query += CalculateRuleAccess(numOverflowRules);
-        
-        int overflowResult = hybridOverflowContainer.search(packet, globalBestPriority);
-        if (overflowResult > globalBestPriority) {
-            globalBestPriority = overflowResult;
-        }
-        searchedOverflow = true;
-    }
     
-    // Search normal trees
-    for (const auto& treePair : treeSearchOrder) {
+    const HybridOverflowContainer::View* overflow = hybridOverflowContainer.view();
+    bool searchedOverflow = overflow->size == 0;
+    
+    for (const auto& treePair : *treeSearchOrder.load(std::memory_order_acquire)) {
         size_t i = treePair.second;
         int maxPri = treePair.first;
         
-        // Only process normal trees
-        if (i >= static_cast<size_t>(normalTreeCount)) {
-            continue;
+        if (!searchedOverflow && overflow->maxPriority > maxPri) {
+            if (overflow->maxPriority > globalBestPriority) {
+                query++;  // Overflow container access: 1 time
+                globalBestPriority = overflow->search(packet, globalBestPriority);
+            }
+            searchedOverflow = true;
         }
         
-        // Use more conservative pruning
-        if (globalBestPriority >= maxPri && globalBestPriority - maxPri > 500) {
-            continue;
+        // Trees are sorted by Maxpri: none of the remaining ones can win
+        if (globalBestPriority >= maxPri) {
+            break;
         }
         
-        Query++;  // Access tree root
-        int treeResult = SearchUltraFastTwoPhase(roots[i], packet, globalBestPriority);
+        query++;  // Access tree root
+        int treeResult = SearchUltraFastTwoPhase(images[i].View(), packet, globalBestPriority, query);
         if (treeResult > globalBestPriority) {
             globalBestPriority = treeResult;
         }
     }
     
-    // Search overflow container if not searched before
-    if (!searchedOverflow && hybridOverflowContainer.size() > 0) {
-        Query++;  
-        int numOverflowRules = static_cast<int>(hybridOverflowContainer.size());
-        // Query += CalculateRuleAccess(numOverflowRules);
-        
-        int overflowResult = hybridOverflowContainer.search(packet, globalBestPriority);
-        if (overflowResult > globalBestPriority) {
-            globalBestPriority = overflowResult;
-        }
+    if (!searchedOverflow && overflow->maxPriority > globalBestPriority) {
+        query++;
+        globalBestPriority = overflow->search(packet, globalBestPriority);
     }
     
-    QueryUpdate(Query);  // Update statistics
     return globalBestPriority;
 }
 
+// ========== Batch Classification ==========
+void T2Tree::ClassifyBatch(const PacketHeader* pkts, size_t n, int* out) {
+    EpochGuard guard;
+    uint64_t query[BATCH_GROUP];
+    for (size_t base = 0; base < n; base += BATCH_GROUP) {
+        size_t count = std::min(BATCH_GROUP, n - base);
+        classifyGroup(pkts + base, count, out + base, query);
+        for (size_t k = 0; k < count; k++) {
+            QueryUpdate(query[k]);
+        }
+    }
+}
+
+void T2Tree::ClassifyBatch(const PacketHeader* pkts, size_t n, int* out, LookupStats& stats) const {
+    EpochGuard guard;
+    uint64_t query[BATCH_GROUP];
+    for (size_t base = 0; base < n; base += BATCH_GROUP) {
+        size_t count = std::min(BATCH_GROUP, n - base);
+        classifyGroup(pkts + base, count, out + base, query);
+        for (size_t k = 0; k < count; k++) {
+            stats.Record(query[k]);
+        }
+    }
+}
+
+// Same search as ClassifyAPacket, but every tree image is walked by the whole group at
+// once: each round advances all lanes by one level and prefetches the node they land on,
+// so the cache misses of independent packets overlap instead of being serialized.
+void T2Tree::classifyGroup(const PacketHeader* pkts, size_t n, int* out, uint64_t* query) const {
+    constexpr int MAX_DEPTH = 32;
+    struct Lane {
+        uint32_t node;                // Node to visit in the next round, 0 when done
+        uint32_t leaf;                // Leaf reached by the descent
+        uint32_t wrsPath[MAX_DEPTH];  // WRS blocks that must be checked in phase 2
+        int wrsPri[MAX_DEPTH];
+        int pathDepth;
+    };
+    Lane lanes[BATCH_GROUP];
+
+    for (size_t k = 0; k < n; k++) {
+        out[k] = -1;
+        query[k] = 0;
+    }
+
+    const HybridOverflowContainer::View* overflow = hybridOverflowContainer.view();
+    bool searchedOverflow = overflow->size == 0;
+    auto searchOverflow = [&]() {
+        for (size_t k = 0; k < n; k++) {
+            if (overflow->maxPriority > out[k]) {
+                query[k]++;
+                out[k] = overflow->search(pkts[k], out[k]);
+            }
+        }
+        searchedOverflow = true;
+    };
+
+    for (const auto& treePair : *treeSearchOrder.load(std::memory_order_acquire)) {
+        size_t i = treePair.second;
+        int maxPri = treePair.first;
+
+        if (!searchedOverflow && overflow->maxPriority > maxPri) {
+            searchOverflow();
+        }
+
+        const ImageView image = images[i].View();
+        const uint32_t* words = image.words;
+        uint32_t root = image.Root();
+        if (!root) {
+            continue;
+        }
+        PREFETCH(words + root);
+
+        size_t pending = 0;
+        for (size_t k = 0; k < n; k++) {
+            Lane& lane = lanes[k];
+            lane.pathDepth = 0;
+            lane.leaf = 0;
+            lane.node = 0;
+            if (out[k] >= maxPri) {
+                continue;
+            }
+            query[k]++;  // Access tree root
+            lane.node = root;
+            pending++;
+        }
+        if (pending == 0) {
+            break;  // Every lane already beats this tree, and so all later ones
+        }
+
+        // Phase 1: interleaved descent, one level per round
+        while (pending > 0) {
+            for (size_t k = 0; k < n; k++) {
+                Lane& lane = lanes[k];
+                uint32_t current = lane.node;
+                if (!current) continue;
+
+                if (words[current] == IMAGE_LEAF || lane.pathDepth >= MAX_DEPTH - 1) {
+                    lane.leaf = words[current] == IMAGE_LEAF ? current : 0;
+                    lane.node = 0;
+                    pending--;
+                    continue;
+                }
+
+                const ImageInternalNode* node = image.Internal(current);
+                if (node->SubtreeBound() <= out[k]) {
+                    lane.node = 0;  // Nothing below can beat the lane's best
+                    pending--;
+                    continue;
+                }
+                bool shouldCheck = node->maxWRSPriority > out[k];
+                lane.wrsPath[lane.pathDepth] = shouldCheck ? node->wrsOffset : 0;
+                lane.wrsPri[lane.pathDepth] = node->maxWRSPriority;
+                lane.pathDepth++;
+
+                int loc = node->Location(pkts[k]);
+                query[k]++;  // Internal node access: 1 time
+
+                lane.node = loc < static_cast<int>(node->nChildren) ? node->Child(loc) : 0;
+                if (lane.node) {
+                    PREFETCH(words + lane.node);
+                    PREFETCH(words + lane.node + 16);
+                } else {
+                    pending--;
+                }
+            }
+        }
+
+        // Leaf search, then Phase 2 over the recorded WRS blocks
+        for (size_t k = 0; k < n; k++) {
+            Lane& lane = lanes[k];
+            int bestPriority = -1;
+
+            if (lane.leaf) {
+                bestPriority = searchLeafComplete(image.Leaf(lane.leaf), pkts[k], out[k]);
+            }
+
+            for (int d = lane.pathDepth - 1; d >= 0; d--) {
+                if (lane.wrsPath[d] && lane.wrsPri[d] > bestPriority) {
+                    query[k]++;  // WRS access: 1 time (hash lookup)
+                    bestPriority = image.WRS(lane.wrsPath[d]).Search(pkts[k], bestPriority);
+                }
+            }
+
+            if (bestPriority > out[k]) {
+                out[k] = bestPriority;
+            }
+        }
+    }
+
+    if (!searchedOverflow) {
+        searchOverflow();
+    }
+}
+
 // ========== Auxiliary Functions ==========
 int T2Tree::countRuleWildcards(const Rule& rule) const {
     int wildcards = 0;
@@ -388,26 +622,36 @@ RuleType T2Tree::classifyRule(const Rule& rule) const {
 }
 
 void T2Tree::buildTreeSearchOrder() {
-    treeSearchOrder.clear();
+    SearchOrder* order = new SearchOrder();
     // Only include normal trees
     for (int i = 0; i < normalTreeCount; i++) {
         if (i < static_cast<int>(Maxpri.size())) {
-            treeSearchOrder.push_back({Maxpri[i], i});
+            order->push_back({Maxpri[i], i});
         }
     }
-    std::sort(treeSearchOrder.begin(), treeSearchOrder.end(), 
+    std::sort(order->begin(), order->end(), 
               std::greater<std::pair<int, size_t>>());
+    
+    // Lookups may still be iterating the previous order
+    const SearchOrder* old = treeSearchOrder.exchange(order, std::memory_order_acq_rel);
+    EpochReclaimer::Retire([old]() { delete old; });
 }
 
 size_t T2Tree::GetOverflowRuleCount() const {
-    return hybridOverflowContainer.size();
+    return hybridOverflowContainer.view()->size;
 }
 
 Memory T2Tree::MemSizeBytes() const {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    return modelMemory();
+}
+
+Memory T2Tree::modelMemory() const {
     int nNodeCount = 0, nRuleCount = 0, nPTRCount = 0, nWRSCount = 0;
     Memory totMemory = 0;
     
-    for (int i = 0; i < normalTreeCount; i++) {
+    for (int i = 0; i < normalTreeCount && i < static_cast<int>(roots.size()); i++) {
+        if (!roots[i]) continue;
         std::queue<T2TreeNode*> que;
         que.push(roots[i]);
         while (!que.empty()) {
@@ -435,23 +679,119 @@ Memory T2Tree::MemSizeBytes() const {
     }
     
     totMemory = nNodeCount * NODE_SIZE + nRuleCount * PTR_SIZE + nPTRCount * PTR_SIZE + nWRSCount * TREE_NODE_SIZE;
-    totMemory += static_cast<Memory>(ruleTreeIndex.size() * sizeof(int8_t));
+    totMemory += static_cast<Memory>(ruleIndex.memoryUsage());
     totMemory += hybridOverflowContainer.memoryUsage();
+    totMemory += static_cast<Memory>(snapshotBytes);
     
     return totMemory;
 }
 
+template <typename T>
+static size_t ArenaBytes(const ArenaVector<T>& v) {
+    return v.capacity() ? TreeArena::BlockBytes(v.capacity() * sizeof(T)) : 0;
+}
+
+void TreeMemory::Add(const TreeMemory& other) {
+    internalNodes += other.internalNodes;
+    leaves += other.leaves;
+    wrs += other.wrs;
+    arenaSlack += other.arenaSlack;
+    image += other.image;
+}
+
+TreeMemory MemoryReport::TreeTotal() const {
+    TreeMemory total;
+    for (const TreeMemory& tree : trees) {
+        total.Add(tree);
+    }
+    return total;
+}
+
+size_t MemoryReport::Total() const {
+    return TreeTotal().Total() + overflowLayers + overflowIdIndex + ruleIndex + updateBuffers + snapshotMapping;
+}
+
+void MemoryReport::Print() const {
+    TreeMemory tree = TreeTotal();
+    printf("\tMeasured memory: %.1f KB (hardware model: %.1f KB)\n", Total() / 1024.0, modelBytes / 1024.0);
+    printf("\t  Trees (%zu): %.1f KB\n", trees.size(), tree.Total() / 1024.0);
+    printf("\t    internal nodes %.1f KB, leaf rules %.1f KB, WRS %.1f KB, arena slack %.1f KB, images %.1f KB\n",
+           tree.internalNodes / 1024.0, tree.leaves / 1024.0, tree.wrs / 1024.0, tree.arenaSlack / 1024.0,
+           tree.image / 1024.0);
+    printf("\t  Overflow layers: %.1f KB, overflow id hash: %.1f KB\n", overflowLayers / 1024.0, overflowIdIndex / 1024.0);
+    printf("\t  Rule index: %.1f KB, update buffers: %.1f KB\n", ruleIndex / 1024.0, updateBuffers / 1024.0);
+    if (snapshotMapping) {
+        printf("\t  Snapshot mapping: %.1f KB\n", snapshotMapping / 1024.0);
+    }
+}
+
+// Nodes and their vectors are counted in arena blocks, so internal nodes, leaves and WRS
+// records add up to what the arena has handed out; the rest of its chunks is slack
+TreeMemory T2Tree::measureTree(size_t tree) const {
+    TreeMemory mem;
+    if (tree < images.size()) {
+        mem.image = images[tree].AllocatedBytes();
+    }
+    const T2TreeNode* root = tree < roots.size() ? roots[tree] : nullptr;
+    if (!root) {
+        return mem;
+    }
+    
+    size_t arenaUsed = 0;
+    std::queue<const T2TreeNode*> que;
+    que.push(root);
+    while (!que.empty()) {
+        const T2TreeNode* node = que.front();
+        que.pop();
+        
+        size_t bytes = TreeArena::BlockBytes(sizeof(T2TreeNode)) + ArenaBytes(node->classifier) +
+                       ArenaBytes(node->opt) + ArenaBytes(node->bit) + ArenaBytes(node->left) +
+                       ArenaBytes(node->children);
+        (node->isLeaf ? mem.leaves : mem.internalNodes) += bytes;
+        arenaUsed += bytes;
+        if (node->wrsNode) {
+            size_t record = TreeArena::BlockBytes(sizeof(WildcardRuleStorage));
+            mem.wrs += record + node->wrsNode->memoryUsage();
+            arenaUsed += record;
+        }
+        for (auto child : node->children) {
+            if (child) {
+                que.push(child);
+            }
+        }
+    }
+    mem.arenaSlack = root->arena->reservedBytes() - std::min(arenaUsed, root->arena->reservedBytes());
+    return mem;
+}
+
+MemoryReport T2Tree::GetMemoryReport() const {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    MemoryReport report;
+    for (int i = 0; i < normalTreeCount; i++) {
+        report.trees.push_back(measureTree(i));
+    }
+    report.overflowLayers = hybridOverflowContainer.layerMemoryUsage();
+    report.overflowIdIndex = hybridOverflowContainer.idIndexMemoryUsage();
+    report.ruleIndex = ruleIndex.memoryUsage();
+    report.updateBuffers = HashTableBytes(updateBuffer.pendingDeletes);
+    report.snapshotMapping = snapshotBytes;
+    report.modelBytes = modelMemory();
+    return report;
+}
+
 size_t T2Tree::NumTables() const {
     return normalTreeCount + (hybridOverflowContainer.size() > 0 ? 1 : 0);
 }
 
 // ========== Search Functions (Fair Memory Access Counting) ==========
-int T2Tree::SearchUltraFastTwoPhase(T2TreeNode* root, const Packet& p, int currentBest) {
-    if (!root) return -1;
+int T2Tree::SearchUltraFastTwoPhase(const ImageView& image, const PacketHeader& p, int currentBest,
+                                    uint64_t& query) const {
+    uint32_t current = image.Root();
+    if (!current) return -1;
     
     constexpr int MAX_DEPTH = 32;
     struct FastPathNode {
-        T2TreeNode* node;
+        uint32_t wrsOffset;
         bool checkWRS;
         int wrsPri;
     };
@@ -459,48 +799,44 @@ int T2Tree::SearchUltraFastTwoPhase(T2TreeNode* root, const Packet& p, int curre
     FastPathNode pathStack[MAX_DEPTH];
     int pathDepth = 0;
     
-    T2TreeNode* current = root;
+    const uint32_t* words = image.words;
     int bestPriority = -1;
     
     // Phase 1: Traverse to leaf node
-    while (current && !current->isLeaf && pathDepth < MAX_DEPTH - 1) {
-        bool shouldCheck = current->hasWRS && current->wrsNode && 
-                          current->wrsNode->size() > 0 &&
-                          current->maxWRSPriority > currentBest;
+    while (current && words[current] != IMAGE_LEAF && pathDepth < MAX_DEPTH - 1) {
+        const ImageInternalNode* node = image.Internal(current);
+        if (node->SubtreeBound() <= currentBest) {
+            current = 0;  // Nothing below, WRS included, can beat the current best
+            break;
+        }
+        bool shouldCheck = node->maxWRSPriority > currentBest;
         
-        pathStack[pathDepth++] = {current, shouldCheck, current->maxWRSPriority};
+        pathStack[pathDepth++] = {node->wrsOffset, shouldCheck, node->maxWRSPriority};
         
-        int loc = CalculatePacketLocation(p, current->opt, current->bit);
-        Query++;  // 🔥 Internal node access: 1 time
+        int loc = node->Location(p);
+        query++;  // 🔥 Internal node access: 1 time
         
-        if (loc < static_cast<int>(current->children.size()) && current->children[loc]) {
-            current = current->children[loc];
-        } else {
-            break;
-        }
+        current = loc < static_cast<int>(node->nChildren) ? node->Child(loc) : 0;
     }
     
     // Search leaf node
-    if (current && current->isLeaf) {
-        bestPriority = searchLeafComplete(current, p, currentBest);
+    if (current && words[current] == IMAGE_LEAF) {
+        bestPriority = searchLeafComplete(image.Leaf(current), p, currentBest);
     }
     
     // Phase 2: Search WRS when necessary
     for (int i = pathDepth - 1; i >= 0; i--) {
         if (pathStack[i].checkWRS && pathStack[i].wrsPri > bestPriority) {
-            Query++;  // 🔥 WRS access: 1 time (hash lookup)
-            int wrsResult = pathStack[i].node->wrsNode->searchHighestPriority(p);
-            if (wrsResult > bestPriority) {
-                bestPriority = wrsResult;
-            }
+            query++;  // 🔥 WRS access: 1 time (hash lookup)
+            bestPriority = image.WRS(pathStack[i].wrsOffset).Search(p, bestPriority);
         }
     }
     
     return bestPriority;
 }
 
-int T2Tree::searchLeafComplete(T2TreeNode* leafNode, const Packet& p, int currentBest) {
-    if (!leafNode || leafNode->classifier.empty()) {
+int T2Tree::searchLeafComplete(const ImageLeafNode* leafNode, const PacketHeader& p, int currentBest) const {
+    if (!leafNode || leafNode->rules.count == 0) {
         return -1;
     }
     
@@ -509,56 +845,80 @@ int T2Tree::searchLeafComplete(T2TreeNode* leafNode, const Packet& p, int curren
         return -1;
     }
     
-    const auto& rules = leafNode->classifier;
-    int numRules = static_cast<int>(rules.size());
-    
     // Cache line based memory access counting
     // Query += CalculateRuleAccess(numRules);
     
     // Rules are sorted in descending priority order, find the first match
-    for (const Rule& rule : rules) {
-        if (rule.priority <= currentBest) {
-            return -1;  // Subsequent rules have lower priority
-        }
-        
-        if (rule.MatchesPacket(p)) {
-            return rule.priority;  // Found the highest priority match
+    int idx = leafNode->rules.FirstMatch(p, currentBest);
+    return idx >= 0 ? leafNode->rules.Priority()[idx] : -1;
+}
+
+// ========== Compiled Images ==========
+void T2Tree::compileSearchImages() {
+    images.clear();
+    // A rebuild may add trees while lookups index this vector, so it must never reallocate
+    images.reserve(std::max(maxTreeNum, normalTreeCount));
+    images.resize(normalTreeCount);
+    for (int i = 0; i < normalTreeCount; i++) {
+        if (roots[i]) {
+            roots[i]->computeSubtreePriority();
         }
+        images[i].SetCopyOnWrite(concurrentUpdates);
+        images[i].Build(roots[i]);
     }
-    
-    return -1;
 }
 
-int T2Tree::recalculateTreeMaxPriority(T2TreeNode* root) {
-    if (!root) return -1;
-    
-    int maxPri = -1;
-    std::queue<T2TreeNode*> que;
-    que.push(root);
-    
-    while (!que.empty()) {
-        T2TreeNode* node = que.front();
-        que.pop();
-        
-        if (node->isLeaf && !node->classifier.empty()) {
-            maxPri = std::max(maxPri, node->classifier[0].priority);
-        }
-        
-        if (node->hasWRS && node->wrsNode && node->wrsNode->size() > 0) {
-            const auto& wrsRules = node->wrsNode->getRules();
-            if (!wrsRules.empty()) {
-                maxPri = std::max(maxPri, wrsRules[0].priority);
-            }
-        }
-        
-        for (auto child : node->children) {
-            if (child) {
-                que.push(child);
+void T2Tree::EnableConcurrentUpdates(bool enable) {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    concurrentUpdates = enable;
+    for (auto& image : images) {
+        image.SetCopyOnWrite(enable);
+    }
+}
+
+void T2Tree::publishNode(T2TreeNode* node) {
+    T2TreeNode* root = node;
+    root->updateSubtreePriority();
+    while (root->parent) {
+        root = root->parent;
+        root->updateSubtreePriority();
+    }
+    for (int i = 0; i < normalTreeCount && i < static_cast<int>(images.size()); i++) {
+        if (roots[i] == root) {
+            images[i].Refresh(node);
+            if (i < static_cast<int>(treeVersion.size())) {
+                treeVersion[i]++;
             }
+            return;
         }
     }
-    
-    return maxPri;
+}
+
+// Maxpri follows the root's subtree bound, which publishNode() keeps exact. The search
+// order is only republished when a tree's maximum actually moves, and then by moving that
+// one entry: most updates touch neither.
+void T2Tree::updateTreeMaxpri(int treeIdx) {
+    int maxPri = roots[treeIdx] ? roots[treeIdx]->maxSubtreePriority : -1;
+    if (Maxpri[treeIdx] == maxPri) {
+        return;
+    }
+    Maxpri[treeIdx] = maxPri;
+
+    // Lookups may be iterating the published order, so the new one is a copy
+    SearchOrder* order = new SearchOrder(*treeSearchOrder.load(std::memory_order_relaxed));
+    auto it = std::find_if(order->begin(), order->end(),
+        [treeIdx](const std::pair<int, size_t>& entry) { return entry.second == static_cast<size_t>(treeIdx); });
+    if (it == order->end()) {
+        delete order;
+        buildTreeSearchOrder();
+        return;
+    }
+    order->erase(it);
+    std::pair<int, size_t> entry{maxPri, static_cast<size_t>(treeIdx)};
+    order->insert(std::lower_bound(order->begin(), order->end(), entry, std::greater<std::pair<int, size_t>>()), entry);
+
+    const SearchOrder* old = treeSearchOrder.exchange(order, std::memory_order_acq_rel);
+    EpochReclaimer::Retire([old]() { delete old; });
 }
 
 int T2Tree::getTreeDepth(T2TreeNode* root) const {
@@ -624,11 +984,17 @@ void T2Tree::extractAllRulesFromTree(T2TreeNode* root, std::vector<Rule>& rules)
 
 // ========== Update Functions ==========
 void T2Tree::InsertRule(const Rule& insert_rule) {
+    if (rejectUpdate()) return;
+    std::lock_guard<std::mutex> lock(updateMutex);
     InsertRuleOptimized(insert_rule);
+    hybridOverflowContainer.publish();
 }
 
 void T2Tree::DeleteRule(const Rule& delete_rule) {
+    if (rejectUpdate()) return;
+    std::lock_guard<std::mutex> lock(updateMutex);
     DeleteRuleOptimized(delete_rule);
+    hybridOverflowContainer.publish();
 }
 
 bool T2Tree::InsertRuleOptimized(const Rule& insert_rule) {
@@ -642,32 +1008,20 @@ bool T2Tree::InsertRuleOptimized(const Rule& insert_rule) {
 }
 
 bool T2Tree::DeleteRuleOptimized(const Rule& delete_rule) {
-    // Check recently inserted rules
-    auto it = std::find_if(updateBuffer.recentInserts.begin(), 
-                           updateBuffer.recentInserts.end(),
-                           [&](const Rule& r) { return r.id == delete_rule.id; });
-    
-    if (it != updateBuffer.recentInserts.end()) {
-        updateBuffer.recentInserts.erase(it);
-        if (delete_rule.id <= maxRuleId && ruleTreeIndex[delete_rule.id] >= 0) {
-            return deleteFromKnownLocation(delete_rule, ruleTreeIndex[delete_rule.id]);
-        }
-    }
-    
     // Use index to locate
-    if (delete_rule.id <= maxRuleId && ruleTreeIndex[delete_rule.id] >= 0) {
-        int treeIdx = ruleTreeIndex[delete_rule.id];
+    if (const RuleHandleTable::Location* loc = ruleIndex.find(delete_rule.id)) {
+        int treeIdx = loc->tree;
         
-        if (treeIdx == 127) {
+        if (treeIdx == OVERFLOW_TREE) {
             // Delete from overflow container
             bool success = hybridOverflowContainer.remove(delete_rule.id);
             if (success) {
-                ruleTreeIndex[delete_rule.id] = -1;
+                ruleIndex.erase(delete_rule.id);
                 // Update overflow container maximum priority
                 overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
             }
             return success;
-        } else if (treeIdx < normalTreeCount) {
+        } else if (treeIdx >= 0 && treeIdx < normalTreeCount) {
             return deleteFromKnownLocation(delete_rule, treeIdx);
         }
     }
@@ -683,15 +1037,10 @@ bool T2Tree::DeleteRuleOptimized(const Rule& delete_rule) {
 
 bool T2Tree::insertToShallowTree(const Rule& rule) {
     // Try recently successful tree first
-    if (updateBuffer.lastSuccessfulTree < normalTreeCount) {
+    if (updateBuffer.lastSuccessfulTree < normalTreeCount && updateBuffer.lastSuccessfulTree != rebuildingTree) {
         if (tryFastInsert(roots[updateBuffer.lastSuccessfulTree], rule)) {
-            if (rule.id <= maxRuleId) {
-                ruleTreeIndex[rule.id] = updateBuffer.lastSuccessfulTree;
-            }
-            updateBuffer.recentInserts.push_back(rule);
-            // Update Maxpri
-            Maxpri[updateBuffer.lastSuccessfulTree] = recalculateTreeMaxPriority(roots[updateBuffer.lastSuccessfulTree]);
-            buildTreeSearchOrder();  // Rebuild search order
+            ruleIndex.at(rule.id).tree = updateBuffer.lastSuccessfulTree;
+            updateTreeMaxpri(updateBuffer.lastSuccessfulTree);
             return true;
         }
     }
@@ -701,7 +1050,7 @@ bool T2Tree::insertToShallowTree(const Rule& rule) {
     int bestIndex = -1;
     
     for (int i = 0; i < normalTreeCount; i++) {
-        if (i == updateBuffer.lastSuccessfulTree) continue;
+        if (i == updateBuffer.lastSuccessfulTree || i == rebuildingTree) continue;
         
         int depth = getTreeDepth(roots[i]);
         if (depth < minDepth) {
@@ -711,14 +1060,9 @@ bool T2Tree::insertToShallowTree(const Rule& rule) {
     }
     
     if (bestIndex >= 0 && tryFastInsert(roots[bestIndex], rule)) {
-        if (rule.id <= maxRuleId) {
-            ruleTreeIndex[rule.id] = bestIndex;
-        }
-        updateBuffer.recentInserts.push_back(rule);
+        ruleIndex.at(rule.id).tree = bestIndex;
         updateBuffer.lastSuccessfulTree = bestIndex;
-        // Update Maxpri
-        Maxpri[bestIndex] = recalculateTreeMaxPriority(roots[bestIndex]);
-        buildTreeSearchOrder();  // Rebuild search order
+        updateTreeMaxpri(bestIndex);
         return true;
     }
     
@@ -728,10 +1072,7 @@ bool T2Tree::insertToShallowTree(const Rule& rule) {
 
 bool T2Tree::insertToOverflowDirect(const Rule& rule) {
     hybridOverflowContainer.insert(rule);
-    
-    if (rule.id <= maxRuleId) {
-        ruleTreeIndex[rule.id] = 127;
-    }
+    ruleIndex.at(rule.id) = {OVERFLOW_TREE, nullptr};
     
     // Update overflow container maximum priority
     overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
@@ -746,27 +1087,26 @@ bool T2Tree::tryFastInsert(T2TreeNode* root, const Rule& rule) {
     for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
         if (current->isLeaf) {
             if (current->nrules < binth * 3) {
-                current->classifier.push_back(rule);
-                current->nrules++;
-                // Maintain sorting
-                std::sort(current->classifier.begin(), current->classifier.end(), 
-                    [](const Rule& a, const Rule& b) { return a.priority > b.priority; });
-                current->updateMaxLeafPriority();
+                current->insertLeafRule(rule);
+                setRuleNode(rule.id, current);
+                publishNode(current);
                 return true;
             }
             return false;
         }
         
-        int loc = CalculateLocation(rule, current->opt, current->bit);
+        int loc = CalculateLocation(rule, current->opt.data(), current->bit.data());
         if (loc == -1) return false;  // Wildcard
         
         if (loc >= static_cast<int>(current->children.size()) || !current->children[loc]) {
             if (loc >= static_cast<int>(current->children.size())) {
                 current->children.resize(loc + 1, nullptr);
             }
-            current->children[loc] = new T2TreeNode({rule}, current->depth + 1, true);
+            current->children[loc] = current->newNode({rule}, current->depth + 1, true);
             current->children[loc]->parent = current;
             current->children[loc]->updateMaxLeafPriority();
+            setRuleNode(rule.id, current->children[loc]);
+            publishNode(current->children[loc]);
             return true;
         }
         
@@ -777,12 +1117,10 @@ bool T2Tree::tryFastInsert(T2TreeNode* root, const Rule& rule) {
 }
 
 bool T2Tree::deleteFromKnownLocation(const Rule& rule, int treeIdx) {
-    if (treeIdx == 127) {
+    if (treeIdx == OVERFLOW_TREE) {
         bool success = hybridOverflowContainer.remove(rule.id);
         if (success) {
-            if (rule.id <= maxRuleId) {
-                ruleTreeIndex[rule.id] = -1;
-            }
+            ruleIndex.erase(rule.id);
             // Update overflow container maximum priority
             overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
         }
@@ -790,14 +1128,9 @@ bool T2Tree::deleteFromKnownLocation(const Rule& rule, int treeIdx) {
     }
     
     if (treeIdx >= 0 && treeIdx < normalTreeCount) {
-        bool success = tryStableDelete(roots[treeIdx], rule);
+        bool success = removeTreeRule(rule, treeIdx);
         if (success) {
-            if (rule.id <= maxRuleId) {
-                ruleTreeIndex[rule.id] = -1;
-            }
-            // Update Maxpri
-            Maxpri[treeIdx] = recalculateTreeMaxPriority(roots[treeIdx]);
-            buildTreeSearchOrder();  // Rebuild search order
+            updateTreeMaxpri(treeIdx);
         }
         return success;
     }
@@ -805,50 +1138,270 @@ bool T2Tree::deleteFromKnownLocation(const Rule& rule, int treeIdx) {
     return false;
 }
 
-bool T2Tree::batchDelete(const std::vector<Rule>& rules) {
-    int successCount = 0;
-    
-    std::unordered_map<int, std::vector<Rule>> treeRules;
+// Remove a rule from tree treeIdx: straight from the node recorded for it, or by walking
+// its path when it has none
+bool T2Tree::removeTreeRule(const Rule& rule, int treeIdx) {
+    const RuleHandleTable::Location* loc = ruleIndex.find(rule.id);
+    T2TreeNode* node = loc ? loc->node : nullptr;
+    bool success = node ? removeFromNode(node, rule) : tryStableDelete(roots[treeIdx], rule);
+    if (success) {
+        ruleIndex.erase(rule.id);
+    }
+    return success;
+}
+
+bool T2Tree::removeFromNode(T2TreeNode* node, const Rule& rule) {
+    if (node->hasWRS && node->wrsNode && node->wrsNode->removeRule(rule)) {
+        node->updateWRSMaxPriority();
+        publishNode(node);
+        return true;
+    }
+    if (!node->isLeaf) {
+        return false;
+    }
+    // Leaves stay sorted by priority for the first-match scan; they hold at most a few
+    // binth rules, so the erase is bounded regardless of the rule set size
+    auto iter = std::find_if(node->classifier.begin(), node->classifier.end(),
+        [&rule](const Rule& r) { return r.id == rule.id; });
+    if (iter == node->classifier.end()) {
+        return false;
+    }
+    node->classifier.erase(iter);
+    node->nrules--;
+    node->updateMaxLeafPriority();
+    publishNode(node);
+    return true;
+}
+
+void T2Tree::indexTreeRules(T2TreeNode* root) {
+    if (!root) return;
+    std::queue<T2TreeNode*> que;
+    que.push(root);
+    while (!que.empty()) {
+        T2TreeNode* node = que.front();
+        que.pop();
+        if (node->isLeaf) {
+            for (const Rule& rule : node->classifier) {
+                setRuleNode(rule.id, node);
+            }
+        }
+        if (node->hasWRS && node->wrsNode) {
+            for (const Rule& rule : node->wrsNode->getRules()) {
+                setRuleNode(rule.id, node);
+            }
+        }
+        for (auto child : node->children) {
+            if (child) {
+                que.push(child);
+            }
+        }
+    }
+}
+
+// Remove rules grouped by the node holding them, so each leaf is compacted and each WRS
+// re-indexed once. Changed nodes are appended to changed for publishNodes(); returns the
+// number of rules removed.
+size_t T2Tree::batchDelete(const std::vector<Rule>& rules, std::vector<T2TreeNode*>& changed) {
+    size_t removed = 0;
+    std::unordered_map<T2TreeNode*, std::unordered_set<int>> byNode;
+    std::vector<T2TreeNode*> nodes;  // First-touch order, so the result is deterministic
     
     for (const auto& rule : rules) {
-        if (rule.id <= maxRuleId && ruleTreeIndex[rule.id] >= 0) {
-            treeRules[ruleTreeIndex[rule.id]].push_back(rule);
+        const RuleHandleTable::Location* loc = ruleIndex.find(rule.id);
+        if (!loc) {
+            continue;
+        }
+        int treeIdx = loc->tree;
+        if (treeIdx == OVERFLOW_TREE) {
+            if (hybridOverflowContainer.remove(rule.id)) {
+                ruleIndex.erase(rule.id);
+                removed++;
+            }
+        } else if (treeIdx >= 0 && treeIdx < normalTreeCount) {
+            T2TreeNode* node = loc->node;
+            if (!node) {
+                removed += removeTreeRule(rule, treeIdx) ? 1 : 0;
+                continue;
+            }
+            auto& ids = byNode[node];
+            if (ids.empty()) {
+                nodes.push_back(node);
+            }
+            ids.insert(rule.id);
         }
     }
+    overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
     
-    for (const auto& [treeIdx, treeRuleList] : treeRules) {
-        if (treeIdx == 127) {
-            for (const auto& rule : treeRuleList) {
-                if (hybridOverflowContainer.remove(rule.id)) {
-                    successCount++;
-                    if (rule.id <= maxRuleId) {
-                        ruleTreeIndex[rule.id] = -1;
-                    }
-                }
+    for (T2TreeNode* node : nodes) {
+        const std::unordered_set<int>& ids = byNode[node];
+        size_t count = 0;
+        if (node->hasWRS && node->wrsNode) {
+            count += node->wrsNode->removeRules(ids);
+            node->updateWRSMaxPriority();
+        }
+        if (node->isLeaf) {
+            auto end = std::remove_if(node->classifier.begin(), node->classifier.end(),
+                [&ids](const Rule& r) { return ids.count(r.id) != 0; });
+            count += static_cast<size_t>(node->classifier.end() - end);
+            node->classifier.erase(end, node->classifier.end());
+            node->nrules = static_cast<int>(node->classifier.size());
+            node->updateMaxLeafPriority();
+        }
+        for (int id : ids) {
+            ruleIndex.erase(id);
+        }
+        if (count > 0) {
+            changed.push_back(node);
+            removed += count;
+        }
+    }
+    return removed;
+}
+
+// The leaf tryFastInsert() would put rule in, counting rules already routed to a leaf in
+// this batch against its capacity; nullptr if the rule does not fit this tree. A missing
+// child is created as an empty leaf in the master tree, published with the batch.
+T2TreeNode* T2Tree::locateInsertLeaf(T2TreeNode* root, const Rule& rule,
+                                     const std::unordered_map<T2TreeNode*, std::vector<Rule>>& pending) {
+    T2TreeNode* current = root;
+    const int MAX_ATTEMPTS = 3;
+    
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+        if (current->isLeaf) {
+            auto it = pending.find(current);
+            size_t queued = it == pending.end() ? 0 : it->second.size();
+            return current->nrules + static_cast<int>(queued) < binth * 3 ? current : nullptr;
+        }
+        
+        int loc = CalculateLocation(rule, current->opt.data(), current->bit.data());
+        if (loc == -1) return nullptr;  // Wildcard
+        
+        if (loc >= static_cast<int>(current->children.size()) || !current->children[loc]) {
+            if (loc >= static_cast<int>(current->children.size())) {
+                current->children.resize(loc + 1, nullptr);
             }
-            // Update overflow container maximum priority
-            overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
-        } else if (treeIdx < normalTreeCount) {
-            for (const auto& rule : treeRuleList) {
-                if (tryStableDelete(roots[treeIdx], rule)) {
-                    successCount++;
-                    if (rule.id <= maxRuleId) {
-                        ruleTreeIndex[rule.id] = -1;
-                    }
+            current->children[loc] = current->newNode({}, current->depth + 1, true);
+            current->children[loc]->parent = current;
+            return current->children[loc];
+        }
+        
+        current = current->children[loc];
+    }
+    
+    return nullptr;
+}
+
+// Route each insert as insertToShallowTree() would, then merge every leaf's new rules into
+// it in one pass. Tree depths are taken once per batch. Rules no tree takes go to the
+// overflow container; returns the number inserted into trees.
+size_t T2Tree::batchInsert(const std::vector<Rule>& rules, std::vector<T2TreeNode*>& changed) {
+    std::vector<int> depth(normalTreeCount);
+    for (int i = 0; i < normalTreeCount; i++) {
+        depth[i] = getTreeDepth(roots[i]);
+    }
+    
+    std::unordered_map<T2TreeNode*, std::vector<Rule>> pending;
+    std::vector<T2TreeNode*> leaves;  // First-touch order
+    size_t inserted = 0;
+    
+    for (const Rule& rule : rules) {
+        int last = updateBuffer.lastSuccessfulTree;
+        int tree = -1;
+        T2TreeNode* leaf = nullptr;
+        if (last < normalTreeCount && last != rebuildingTree) {
+            leaf = locateInsertLeaf(roots[last], rule, pending);
+            tree = last;
+        }
+        if (!leaf) {
+            int bestIndex = -1;
+            for (int i = 0; i < normalTreeCount; i++) {
+                if (i == last || i == rebuildingTree) continue;
+                if (bestIndex < 0 || depth[i] < depth[bestIndex]) {
+                    bestIndex = i;
                 }
             }
-            // Update Maxpri for this tree
-            if (successCount > 0) {
-                Maxpri[treeIdx] = recalculateTreeMaxPriority(roots[treeIdx]);
+            if (bestIndex >= 0) {
+                leaf = locateInsertLeaf(roots[bestIndex], rule, pending);
+                tree = bestIndex;
             }
         }
+        if (!leaf) {
+            insertToOverflowDirect(rule);
+            continue;
+        }
+        
+        updateBuffer.lastSuccessfulTree = tree;
+        depth[tree] = std::max(depth[tree], leaf->depth);
+        auto& queued = pending[leaf];
+        if (queued.empty()) {
+            leaves.push_back(leaf);
+        }
+        queued.push_back(rule);
+        ruleIndex.at(rule.id) = {tree, leaf};
+        inserted++;
+    }
+    
+    auto byPriority = [](const Rule& a, const Rule& b) { return a.priority > b.priority; };
+    for (T2TreeNode* leaf : leaves) {
+        std::vector<Rule>& queued = pending[leaf];
+        std::stable_sort(queued.begin(), queued.end(), byPriority);
+        // Queued rules go after existing rules of equal priority, as insertLeafRule() puts them
+        auto& rules = leaf->classifier;
+        size_t existing = rules.size();
+        rules.insert(rules.end(), queued.begin(), queued.end());
+        std::inplace_merge(rules.begin(), rules.begin() + existing, rules.end(), byPriority);
+        leaf->nrules = static_cast<int>(leaf->classifier.size());
+        leaf->updateMaxLeafPriority();
+        changed.push_back(leaf);
+    }
+    return inserted;
+}
+
+// Publish every node a batch changed: subtree bounds first, then one image refresh per
+// tree, then the trees' maxima and the search order once
+void T2Tree::publishNodes(const std::vector<T2TreeNode*>& nodes) {
+    std::unordered_map<const T2TreeNode*, int> treeOf;
+    for (int i = 0; i < normalTreeCount; i++) {
+        treeOf[roots[i]] = i;
     }
     
-    if (successCount > 0) {
-        buildTreeSearchOrder();  // Rebuild search order
+    // Every walk recomputes all of its ancestors, so the last walk through a shared
+    // ancestor sees all of its changed descendants
+    std::vector<std::vector<T2TreeNode*>> perTree(normalTreeCount);
+    std::unordered_set<T2TreeNode*> seen;
+    for (T2TreeNode* node : nodes) {
+        if (!seen.insert(node).second) {
+            continue;  // Changed by both a delete and an insert
+        }
+        T2TreeNode* root = node;
+        root->updateSubtreePriority();
+        while (root->parent) {
+            root = root->parent;
+            root->updateSubtreePriority();
+        }
+        auto it = treeOf.find(root);
+        if (it != treeOf.end()) {
+            perTree[it->second].push_back(node);
+        }
     }
     
-    return successCount > 0;
+    bool moved = false;
+    for (int i = 0; i < normalTreeCount; i++) {
+        if (!perTree[i].empty() && i < static_cast<int>(images.size())) {
+            images[i].Refresh(perTree[i]);
+            if (i < static_cast<int>(treeVersion.size())) {
+                treeVersion[i]++;
+            }
+        }
+        int maxPri = roots[i] ? roots[i]->maxSubtreePriority : -1;
+        if (Maxpri[i] != maxPri) {
+            Maxpri[i] = maxPri;
+            moved = true;
+        }
+    }
+    if (moved) {
+        buildTreeSearchOrder();
+    }
 }
 
 void T2Tree::processPendingDeletes() {
@@ -857,13 +1410,12 @@ void T2Tree::processPendingDeletes() {
     bool needRebuild = false;
     
     for (int id : updateBuffer.pendingDeletes) {
-        if (id <= maxRuleId && ruleTreeIndex[id] >= 0) {
-            int treeIdx = ruleTreeIndex[id];
-            if (treeIdx == 127) {
+        if (const RuleHandleTable::Location* loc = ruleIndex.find(id)) {
+            if (loc->tree == OVERFLOW_TREE) {
                 hybridOverflowContainer.remove(id);
                 needRebuild = true;
             }
-            ruleTreeIndex[id] = -1;
+            ruleIndex.erase(id);
         }
     }
     
@@ -876,13 +1428,23 @@ void T2Tree::processPendingDeletes() {
 
 UpdateStatistics T2Tree::performBatchUpdate(const std::vector<Rule>& rules, 
                                            const std::vector<int>& operations) {
+    if (rejectUpdate()) return UpdateStatistics();
+    std::lock_guard<std::mutex> lock(updateMutex);
+    return applyBatchUpdate(rules, operations);
+}
+
+// Deletes, then inserts, each grouped by the node they touch; lookups see the changed nodes,
+// the search order and the overflow container republished once per batch
+UpdateStatistics T2Tree::applyBatchUpdate(const std::vector<Rule>& rules, 
+                                         const std::vector<int>& operations) {
     UpdateStatistics stats;
+    auto start = std::chrono::steady_clock::now();
     
     std::vector<Rule> easyInserts;
     std::vector<Rule> hardInserts;
     std::vector<Rule> deletes;
     
-    for (size_t i = 0; i < rules.size(); i++) {
+    for (size_t i = 0; i < rules.size() && i < operations.size(); i++) {
         if (operations[i] == 0) {  // Insert
             if (classifyRule(rules[i]) == SPECIFIC_RULE) {
                 easyInserts.push_back(rules[i]);
@@ -896,17 +1458,11 @@ UpdateStatistics T2Tree::performBatchUpdate(const std::vector<Rule>& rules,
         }
     }
     
-    if (!deletes.empty()) {
-        if (batchDelete(deletes)) {
-            stats.deleteSuccesses = static_cast<uint32_t>(deletes.size());
-        }
-    }
-    
-    for (const auto& rule : easyInserts) {
-        if (insertToShallowTree(rule)) {
-            stats.insertSuccesses++;
-        }
-    }
+    std::vector<T2TreeNode*> changed;
+    stats.deleteSuccesses = static_cast<uint32_t>(batchDelete(deletes, changed));
+    batchInsert(easyInserts, changed);
+    stats.insertSuccesses += static_cast<uint32_t>(easyInserts.size());
+    publishNodes(changed);
     
     for (const auto& rule : hardInserts) {
         insertToOverflowDirect(rule);
@@ -917,18 +1473,23 @@ UpdateStatistics T2Tree::performBatchUpdate(const std::vector<Rule>& rules,
         hybridOverflowContainer.optimize();
         overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
     }
+    hybridOverflowContainer.publish();
     
     updateBuffer.clear();
     
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats.recordBatch(elapsed.count());
     return stats;
 }
 
 UpdateStatistics T2Tree::performStableUpdate(const std::vector<Rule>& rules, 
                                             const std::vector<int>& operations) {
     UpdateStatistics stats;
+    if (rejectUpdate()) return stats;
+    std::lock_guard<std::mutex> lock(updateMutex);
     
     if (rules.size() > 1000) {
-        return performBatchUpdate(rules, operations);
+        return applyBatchUpdate(rules, operations);
     }
     
     for (size_t i = 0; i < rules.size() && i < operations.size(); i++) {
@@ -955,10 +1516,291 @@ UpdateStatistics T2Tree::performStableUpdate(const std::vector<Rule>& rules,
     }
     
     processPendingDeletes();
+    hybridOverflowContainer.publish();
     
     return stats;
 }
 
+// ========== Degradation Repair ==========
+TreeHealth T2Tree::healthOf(const T2TreeNode* root) const {
+    TreeHealth health;
+    if (!root) return health;
+    
+    std::queue<const T2TreeNode*> que;
+    que.push(root);
+    while (!que.empty()) {
+        const T2TreeNode* node = que.front();
+        que.pop();
+        
+        if (node->isLeaf) {
+            health.rules += node->nrules;
+            health.leaves++;
+            if (node->nrules > binth) {
+                health.overfullLeaves++;
+            }
+        }
+        if (node->hasWRS && node->wrsNode) {
+            health.rules += static_cast<int>(node->wrsNode->size());
+            health.wrsRules += static_cast<int>(node->wrsNode->size());
+            health.wrsCapacity += node->wrsNode->getCapacity();
+        }
+        for (auto child : node->children) {
+            if (child) {
+                que.push(child);
+            }
+        }
+    }
+    return health;
+}
+
+void T2Tree::recordBuiltHealth() {
+    builtHealth.clear();
+    for (int i = 0; i < normalTreeCount; i++) {
+        builtHealth.push_back(healthOf(roots[i]));
+    }
+    builtOverflow = hybridOverflowContainer.size();
+}
+
+TreeHealth T2Tree::GetTreeHealth(size_t tree) const {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    return tree < static_cast<size_t>(normalTreeCount) ? healthOf(roots[tree]) : TreeHealth();
+}
+
+void T2Tree::SetRebuildPolicy(const RebuildPolicy& policy) {
+    std::lock_guard<std::mutex> lock(updateMutex);
+    rebuildPolicy = policy;
+}
+
+// Pick what to rebuild and copy its rules, false if nothing has degraded past the policy.
+// Overflow growth comes first: it costs every packet that reaches the overflow, while a
+// worn tree only costs the packets that land in its grown leaves.
+bool T2Tree::planRebuild(RebuildJob& job) {
+    job = RebuildJob();
+    job.binth = binth;
+    job.overflowChanges = hybridOverflowContainer.changes();
+    job.constructions = constructions;
+    
+    size_t growth = std::max(rebuildPolicy.minOverflowGrowth,
+                             static_cast<size_t>(builtOverflow * rebuildPolicy.overflowGrowthShare));
+    if (hybridOverflowContainer.size() >= builtOverflow + growth) {
+        // Deletes drain trees while the inserts that would refill them miss and overflow, so
+        // the tree that lost the most rules takes the overflow in. Failing that, a new tree
+        // while the tree budget allows, else the smallest tree.
+        int mostDrained = -1, maxDrain = binth - 1, smallest = -1, smallestRules = INT_MAX;
+        for (int i = 0; i < normalTreeCount; i++) {
+            int treeRules = countTreeRules(roots[i]);
+            int drain = i < static_cast<int>(builtHealth.size()) ? builtHealth[i].rules - treeRules : 0;
+            if (drain > maxDrain) {
+                maxDrain = drain;
+                mostDrained = i;
+            }
+            if (treeRules < smallestRules) {
+                smallestRules = treeRules;
+                smallest = i;
+            }
+        }
+        job.tree = mostDrained >= 0 ? mostDrained : normalTreeCount < maxTreeNum - 1 ? normalTreeCount : smallest;
+        if (job.tree < 0) {
+            return false;
+        }
+        if (job.tree < normalTreeCount) {
+            extractAllRulesFromTree(roots[job.tree], job.rules);
+        }
+        size_t treeRules = job.rules.size();
+        hybridOverflowContainer.collectRules(job.rules);
+        for (size_t i = treeRules; i < job.rules.size(); i++) {
+            job.fromOverflow.insert(job.rules[i].id);
+        }
+    } else {
+        double worstExcess = 0.0;
+        for (int i = 0; i < normalTreeCount && i < static_cast<int>(builtHealth.size()); i++) {
+            TreeHealth now = healthOf(roots[i]);
+            const TreeHealth& built = builtHealth[i];
+            double excess = std::max(now.OverfullShare() - built.OverfullShare() - rebuildPolicy.overfullLeafGrowth,
+                                     built.WRSFill() - now.WRSFill() - rebuildPolicy.wrsDrain);
+            if (now.rules > 0 && excess >= 0.0 && (job.tree < 0 || excess > worstExcess)) {
+                worstExcess = excess;
+                job.tree = i;
+            }
+        }
+        if (job.tree < 0) {
+            return false;
+        }
+        extractAllRulesFromTree(roots[job.tree], job.rules);
+    }
+    
+    if (job.tree < normalTreeCount) {
+        job.treeVersion = treeVersion[job.tree];
+    }
+    std::sort(job.rules.begin(), job.rules.end(),
+        [](const Rule& a, const Rule& b) { return a.priority > b.priority; });
+    return true;
+}
+
+// Whether the rules a job copied are still where it found them. Any change to its tree
+// invalidates it; overflow changes only if they touched a rule the job takes in.
+bool T2Tree::jobCurrent(const RebuildJob& job) const {
+    if (job.constructions != constructions) {
+        return false;
+    }
+    if (job.tree < normalTreeCount && treeVersion[job.tree] != job.treeVersion) {
+        return false;
+    }
+    if (hybridOverflowContainer.changes() == job.overflowChanges) {
+        return true;
+    }
+    for (const Rule& rule : job.rules) {
+        if (!job.fromOverflow.count(rule.id)) {
+            continue;
+        }
+        const Rule* current = hybridOverflowContainer.find(rule.id);
+        if (!current || current->priority != rule.priority || current->range != rule.range) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Build the job's tree on a private scratch instance: it shares no state with this one,
+// so the build runs without the writer lock
+T2TreeNode* T2Tree::buildDetached(const RebuildJob& job, std::vector<Rule>& kickedRules) const {
+    T2Tree builder(maxBits, maxLevel, job.binth, maxTreeNum, wrsThreshold);
+    builder.SetBuildThreads(buildThreads);
+    builder.Maxpri.push_back(-1);
+    return builder.buildTree(job.rules, kickedRules, job.tree);
+}
+
+// Swap a built tree in. Each step leaves lookups a complete structure: rules leaving the
+// tree are published in the overflow before the old image goes, and rules leaving the
+// overflow only after the new image and search order are out. In between a rule may be
+// found twice, which cannot change a result.
+bool T2Tree::commitRebuild(const RebuildJob& job, T2TreeNode* root, const std::vector<Rule>& kickedRules) {
+    std::unordered_set<int> kickedIds;
+    for (const Rule& rule : kickedRules) {
+        kickedIds.insert(rule.id);
+    }
+    
+    // Re-absorbing must drain the overflow by enough to pay for the tree it adds or reshapes
+    if (!job.fromOverflow.empty()) {
+        int absorbed = 0;
+        for (int id : job.fromOverflow) {
+            absorbed += kickedIds.count(id) ? 0 : 1;
+        }
+        for (const Rule& rule : kickedRules) {
+            absorbed -= job.fromOverflow.count(rule.id) ? 0 : 1;
+        }
+        int minAbsorbed = rebuildPolicy.minAbsorbedRules > 0 ? rebuildPolicy.minAbsorbedRules : binth;
+        if (absorbed < minAbsorbed) {
+            builtOverflow = hybridOverflowContainer.size();  // Wait for more growth before retrying
+            T2TreeNode::FreeTree(root);
+            return false;
+        }
+    }
+    
+    for (const Rule& rule : kickedRules) {
+        if (!job.fromOverflow.count(rule.id)) {
+            hybridOverflowContainer.insert(rule);
+            ruleIndex.at(rule.id) = {OVERFLOW_TREE, nullptr};
+        }
+    }
+    hybridOverflowContainer.publish();
+    
+    int t = job.tree;
+    if (t == normalTreeCount) {
+        // compileSearchImages() reserved room for maxTreeNum images, so this never moves one
+        images.emplace_back();
+        images.back().SetCopyOnWrite(concurrentUpdates);
+        roots.push_back(nullptr);
+        Maxpri.push_back(-1);
+        treeVersion.push_back(0);
+        builtHealth.push_back(TreeHealth());
+        normalTreeCount++;
+    }
+    images[t].Build(root);  // Publishes a fresh image and retires the old one
+    T2TreeNode* old = roots[t];
+    roots[t] = root;
+    
+    indexTreeRules(root);
+    for (const Rule& rule : job.rules) {
+        if (!kickedIds.count(rule.id)) {
+            ruleIndex.at(rule.id).tree = t;
+        }
+    }
+    Maxpri[t] = root ? root->maxSubtreePriority : -1;
+    buildTreeSearchOrder();
+    
+    for (int id : job.fromOverflow) {
+        if (!kickedIds.count(id)) {
+            hybridOverflowContainer.remove(id);
+        }
+    }
+    overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
+    hybridOverflowContainer.publish();
+    
+    T2TreeNode::FreeTree(old);  // Lookups read only images, never master nodes
+    treeVersion[t]++;
+    builtHealth[t] = healthOf(root);
+    // The overflow target stays the post-build size: further steps keep draining it there
+    builtOverflow = std::min(builtOverflow, hybridOverflowContainer.size());
+    rebuildCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool T2Tree::RebuildDegraded() {
+    if (rejectUpdate()) return false;
+    
+    for (int attempt = 0;; attempt++) {
+        std::unique_lock<std::mutex> lock(updateMutex);
+        RebuildJob job;
+        if (!planRebuild(job)) {
+            return false;
+        }
+        std::vector<Rule> kickedRules;
+        if (attempt >= MAX_OPTIMISTIC_REBUILDS) {
+            // Updates kept invalidating the copy: build while holding them off
+            T2TreeNode* root = buildDetached(job, kickedRules);
+            return commitRebuild(job, root, kickedRules);
+        }
+        
+        rebuildingTree = job.tree;
+        lock.unlock();
+        T2TreeNode* root = buildDetached(job, kickedRules);
+        lock.lock();
+        rebuildingTree = -1;
+        
+        if (jobCurrent(job)) {
+            return commitRebuild(job, root, kickedRules);
+        }
+        T2TreeNode::FreeTree(root);
+    }
+}
+
+void T2Tree::StartBackgroundRebuild(std::chrono::milliseconds interval) {
+    if (rejectUpdate()) return;
+    StopBackgroundRebuild();
+    
+    rebuildStop = false;
+    rebuildThread = std::thread([this, interval]() {
+        std::unique_lock<std::mutex> lock(rebuildWakeMutex);
+        while (!rebuildWake.wait_for(lock, interval, [this]() { return rebuildStop; })) {
+            lock.unlock();
+            RebuildDegraded();
+            lock.lock();
+        }
+    });
+}
+
+void T2Tree::StopBackgroundRebuild() {
+    {
+        std::lock_guard<std::mutex> lock(rebuildWakeMutex);
+        rebuildStop = true;
+    }
+    rebuildWake.notify_all();
+    if (rebuildThread.joinable()) {
+        rebuildThread.join();
+    }
+}
+
 // ========== Compatibility Functions ==========
 bool T2Tree::InsertRuleStable(const Rule& insert_rule) {
     return InsertRuleOptimized(insert_rule);
@@ -977,11 +1819,19 @@ bool T2Tree::DeleteRuleCompatible(const Rule& delete_rule) {
 }
 
 bool T2Tree::InsertRuleConservative(const Rule& insert_rule) {
-    return InsertRuleOptimized(insert_rule);
+    if (rejectUpdate()) return false;
+    std::lock_guard<std::mutex> lock(updateMutex);
+    bool success = InsertRuleOptimized(insert_rule);
+    hybridOverflowContainer.publish();
+    return success;
 }
 
 bool T2Tree::DeleteRuleSimple(const Rule& delete_rule) {
-    return DeleteRuleOptimized(delete_rule);
+    if (rejectUpdate()) return false;
+    std::lock_guard<std::mutex> lock(updateMutex);
+    bool success = DeleteRuleOptimized(delete_rule);
+    hybridOverflowContainer.publish();
+    return success;
 }
 
 bool T2Tree::tryCompatibleInsert(T2TreeNode* root, const Rule& insert_rule) {
@@ -1024,6 +1874,8 @@ bool T2Tree::tryStableInsert(T2TreeNode* root, const Rule& insert_rule) {
             if (current->hasWRS && current->wrsNode) {
                 if (current->wrsNode->addRule(insert_rule)) {
                     current->updateWRSMaxPriority();
+                    setRuleNode(insert_rule.id, current);
+                    publishNode(current);
                     return true;
                 }
             }
@@ -1036,9 +1888,11 @@ bool T2Tree::tryStableInsert(T2TreeNode* root, const Rule& insert_rule) {
         
         if (!current->children[loc]) {
             std::vector<Rule> newTreeRule = {insert_rule};
-            current->children[loc] = new T2TreeNode(newTreeRule, current->depth + 1, true);
+            current->children[loc] = current->newNode(newTreeRule, current->depth + 1, true);
             current->children[loc]->parent = current;
             current->children[loc]->updateMaxLeafPriority();
+            setRuleNode(insert_rule.id, current->children[loc]);
+            publishNode(current->children[loc]);
             return true;
         }
         
@@ -1052,12 +1906,9 @@ bool T2Tree::tryStableInsert(T2TreeNode* root, const Rule& insert_rule) {
         }
         
         if (current->nrules < dynamicCapacity) {
-            current->classifier.push_back(insert_rule);
-            current->nrules++;
-            current->updateMaxLeafPriority();
-            
-            std::sort(current->classifier.begin(), current->classifier.end(), 
-                [](const Rule& a, const Rule& b) { return a.priority > b.priority; });
+            current->insertLeafRule(insert_rule);
+            setRuleNode(insert_rule.id, current);
+            publishNode(current);
             return true;
         }
     }
@@ -1072,6 +1923,7 @@ bool T2Tree::tryStableDelete(T2TreeNode* root, const Rule& delete_rule) {
         if (current->hasWRS && current->wrsNode) {
             if (current->wrsNode->removeRule(delete_rule)) {
                 current->updateWRSMaxPriority();
+                publishNode(current);
                 return true;
             }
         }
@@ -1110,6 +1962,7 @@ bool T2Tree::tryStableDelete(T2TreeNode* root, const Rule& delete_rule) {
             current->classifier.erase(iter);
             current->nrules--;
             current->updateMaxLeafPriority();
+            publishNode(current);
             return true;
         }
     }
@@ -1133,12 +1986,20 @@ void T2Tree::performBalancedTreeMerging() {
     
     int keepTrees = std::max(normalTreeCount * 3 / 4, 3);
     
+    // Kept trees are renumbered, so the rule index must follow them
+    std::vector<int> newIndex(normalTreeCount, -1);
     for (int i = 0; i < keepTrees && i < static_cast<int>(treeSizes.size()); i++) {
         int idx = treeSizes[i].second;
+        newIndex[idx] = static_cast<int>(newRoots.size());
         newRoots.push_back(roots[idx]);
         newMaxpri.push_back(Maxpri[idx]);
         roots[idx] = nullptr;
     }
+    ruleIndex.forEach([&](int, RuleHandleTable::Location& loc) {
+        if (loc.tree >= 0 && loc.tree < normalTreeCount) {
+            loc.tree = newIndex[loc.tree];
+        }
+    });
     
     // Collect rules from small trees into overflow container
     for (size_t i = keepTrees; i < treeSizes.size(); i++) {
@@ -1148,11 +2009,9 @@ void T2Tree::performBalancedTreeMerging() {
             extractAllRulesFromTree(roots[idx], treeRules);
             for (const auto& rule : treeRules) {
                 hybridOverflowContainer.insert(rule);
-                if (rule.id <= maxRuleId) {
-                    ruleTreeIndex[rule.id] = 127;
-                }
+                ruleIndex.at(rule.id) = {OVERFLOW_TREE, nullptr};
             }
-            delete roots[idx];
+            T2TreeNode::FreeTree(roots[idx]);
             roots[idx] = nullptr;
         }
     }
@@ -1164,8 +2023,8 @@ void T2Tree::performBalancedTreeMerging() {
     
     if (hybridOverflowContainer.size() > 500) {
         hybridOverflowContainer.optimize();
-        overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
     }
+    overflowMaxPriority = hybridOverflowContainer.getMaxPriority();
 }
 
 int T2Tree::getBalancedAggressiveLeafCapacity(int remainingRules, int treeIndex) {
@@ -1191,11 +2050,37 @@ int T2Tree::getBalancedAggressiveLeafCapacity(int remainingRules, int treeIndex)
     return baseCapacity;
 }
 
+// ========== Parallel Construction ==========
+// Threads used to build trees concurrently: requested, or all OpenMP threads when 0
+int T2Tree::BuildThreadCount(int requested) {
+#ifdef _OPENMP
+    return requested > 0 ? requested : omp_get_max_threads();
+#else
+    (void)requested;
+    return 1;
+#endif
+}
+
+// Build tree treeIndex of the construction from rules (sorted by descending priority), with
+// the leaf capacity that tree gets; rules left out are appended to kickedRules. Maxpri.back()
+// is used as the tree's scratch maximum, as in CreateSubT2TreeBalancedOptimized.
+T2TreeNode* T2Tree::buildTree(const std::vector<Rule>& rules, std::vector<Rule>& kickedRules, int treeIndex) {
+    int originalBinth = binth;
+    binth = getBalancedAggressiveLeafCapacity(static_cast<int>(rules.size()), treeIndex);
+    T2TreeNode* node = CreateSubT2TreeBalancedOptimized(rules, kickedRules, treeIndex);
+    binth = originalBinth;
+    if (node) {
+        node->computeSubtreePriority();
+    }
+    return node;
+}
+
 // ========== Tree Construction Functions (Fixed Version) ==========
 T2TreeNode* T2Tree::CreateSubT2TreeBalancedOptimized(const std::vector<Rule>& rules, 
                                                      std::vector<Rule>& kickedRules, 
                                                      int treeIndex) {
-    auto* root = new T2TreeNode(rules, 1, false);
+    TreeArena* arena = new TreeArena();  // Owned by the tree, freed with T2TreeNode::FreeTree
+    auto* root = arena->create<T2TreeNode>(arena, rules, 1, false);
     std::queue<T2TreeNode*> que;
     que.push(root);
     
@@ -1232,17 +2117,25 @@ T2TreeNode* T2Tree::CreateSubT2TreeBalancedOptimized(const std::vector<Rule>& ru
             continue;
         }
 
-        int Min = node->nrules, minKicked = node->nrules;
-        std::vector<int> bestOpt = partitionOpt[0];
-        std::vector<int> bestBit = GetSelectBit(node, partitionOpt[0]);
+        // One sweep over the node's rules; every candidate below is scored from it
+        const NodeBitStatistics stats(node->classifier.data(), node->classifier.size());
+
+        // Score the candidates independently (in parallel for large nodes), then pick in
+        // partitionOpt order so the choice, ties included, never depends on the thread count
+        int nCandidates = static_cast<int>(partitionOpt.size());
+        std::vector<int> candidateMax(nCandidates), candidateKicked(nCandidates);
+        std::vector<std::vector<int>> candidateBit(nCandidates);
 
-        for (auto opt : partitionOpt) {
+#pragma omp parallel for schedule(dynamic) num_threads(BuildThreadCount(buildThreads)) \
+        if (node->nrules >= PARALLEL_BUILD_MIN_RULES)
+        for (int c = 0; c < nCandidates; c++) {
+            std::vector<int>& opt = partitionOpt[c];
             std::vector<int> subnRules(1 << maxBits, 0);
             int nKickedRules = 0;
-            std::vector<int> bit = GetSelectBit(node, opt);
+            std::vector<int> bit = stats.SelectBits(node->left.data(), opt);
 
-            for (const Rule& rule : node->classifier) {
-                int loc = CalculateLocation(rule, opt, bit);
+            for (size_t r = 0; r < stats.size(); r++) {
+                int loc = stats.Location(r, opt, bit);
                 if (loc == -1) {
                     nKickedRules++;
                 } else {
@@ -1254,11 +2147,21 @@ T2TreeNode* T2Tree::CreateSubT2TreeBalancedOptimized(const std::vector<Rule>& ru
             for (int i : subnRules) {
                 maxRule = std::max(i + nKickedRules, maxRule);
             }
-            if (maxRule < Min || (maxRule == Min && nKickedRules <= minKicked)) {
-                Min = maxRule;
-                minKicked = nKickedRules;
-                bestOpt = opt;
-                bestBit = bit;
+            candidateMax[c] = maxRule;
+            candidateKicked[c] = nKickedRules;
+            candidateBit[c] = std::move(bit);
+        }
+
+        int Min = node->nrules, minKicked = node->nrules;
+        std::vector<int> bestOpt = partitionOpt[0];
+        std::vector<int> bestBit = candidateBit[0];
+
+        for (int c = 0; c < nCandidates; c++) {
+            if (candidateMax[c] < Min || (candidateMax[c] == Min && candidateKicked[c] <= minKicked)) {
+                Min = candidateMax[c];
+                minKicked = candidateKicked[c];
+                bestOpt = partitionOpt[c];
+                bestBit = candidateBit[c];
             }
         }
 
@@ -1289,25 +2192,26 @@ T2TreeNode* T2Tree::CreateSubT2TreeBalancedOptimized(const std::vector<Rule>& ru
             continue;
         }
 
-        node->opt = bestOpt;
-        node->bit = bestBit;
+        node->opt.assign(bestOpt.begin(), bestOpt.end());
+        node->bit.assign(bestBit.begin(), bestBit.end());
 
         std::vector<Rule> normalRules;
         std::vector<Rule> wildcardRules;
         
         for (const Rule& rule : node->classifier) {
-            if (hasWildcardInSelectedBits(rule, bestOpt, bestBit)) {
+            if (hasWildcardInSelectedBits(rule, bestOpt.data(), bestBit.data())) {
                 wildcardRules.push_back(rule);
             } else {
                 normalRules.push_back(rule);
             }
         }
+        node->dropRules();  // Everything below works from the split copies
 
         ProcessWildcardRulesBalanced(node, wildcardRules, kickedRules, balancedWRSThreshold);
 
         std::vector<std::vector<Rule>> childRule(1 << maxBits);
         for (const Rule& rule : normalRules) {
-            int loc = CalculateLocation(rule, bestOpt, bestBit);
+            int loc = CalculateLocation(rule, bestOpt.data(), bestBit.data());
             if (loc == -1) {
                 kickedRules.push_back(rule);
             } else {
@@ -1315,7 +2219,7 @@ T2TreeNode* T2Tree::CreateSubT2TreeBalancedOptimized(const std::vector<Rule>& ru
             }
         }
 
-        std::vector<int> subNodeLeft = node->left;
+        ArenaVector<int> subNodeLeft = node->left;
         for (int i = 0; i < maxBits; i++) {
             if (bestOpt[i] == -1) {
                 continue;
@@ -1326,7 +2230,7 @@ T2TreeNode* T2Tree::CreateSubT2TreeBalancedOptimized(const std::vector<Rule>& ru
         node->children.resize(1 << maxBits, nullptr);
         for (size_t i = 0; i < childRule.size(); i++) {
             if (!childRule[i].empty()) {
-                node->children[i] = new T2TreeNode(childRule[i], node->depth + 1, false);
+                node->children[i] = node->newNode(childRule[i], node->depth + 1, false);
                 node->children[i]->left = subNodeLeft;
                 node->children[i]->parent = node;
                 que.push(node->children[i]);
@@ -1358,7 +2262,7 @@ void T2Tree::ProcessWildcardRulesBalanced(T2TreeNode* node,
         int balancedWRSCapacity = std::min({
             static_cast<int>(wildcardRules.size()),
             static_cast<int>(binth * 1.3),
-            15
+            WRS_MAX_CAPACITY
         });
         
         if (balancedWRSCapacity >= adjustedThreshold) {
@@ -1371,14 +2275,8 @@ void T2Tree::ProcessWildcardRulesBalanced(T2TreeNode* node,
                         return a.priority > b.priority;
                     });
                 
-                int added = 0;
-                for (const Rule& rule : sortedWildcards) {
-                    if (added < balancedWRSCapacity && node->wrsNode->addRule(rule)) {
-                        added++;
-                    } else {
-                        kickedRules.push_back(rule);
-                    }
-                }
+                size_t added = node->wrsNode->addRules(sortedWildcards);
+                kickedRules.insert(kickedRules.end(), sortedWildcards.begin() + added, sortedWildcards.end());
                 node->updateWRSMaxPriority();
                 
                 // Record the maximum priority of WRS node
@@ -1395,7 +2293,7 @@ void T2Tree::ProcessWildcardRulesBalanced(T2TreeNode* node,
 }
 
 // ========== Bit Operation Functions ==========
-bool T2Tree::hasWildcardInSelectedBits(const Rule& rule, const std::vector<int>& opt, const std::vector<int>& bit) {
+bool T2Tree::hasWildcardInSelectedBits(const Rule& rule, const int* opt, const int* bit) {
     for (int i = 0; i < maxBits; i++) {
         if (opt[i] == -1 || bit[i] == -1) {
             continue;
@@ -1409,48 +2307,10 @@ bool T2Tree::hasWildcardInSelectedBits(const Rule& rule, const std::vector<int>&
 }
 
 std::vector<int> T2Tree::GetSelectBit(T2TreeNode* node, std::vector<int>& opt) {
-    std::vector<int> left = node->left;
-    std::vector<int> bit;
-    
-    for (int& i : opt) {
-        if (i == -1) {
-            bit.push_back(-1);
-            continue;
-        }
-        while (true) {
-            bool oneFlag = false, zeroFlag = false, wildcardFlag = true;
-            int field = i, bitIndex = left[i];
-            for (const Rule& rule : node->classifier) {
-                int t = rule.Getbit(field, bitIndex);
-                if (t == -1) {
-                    continue;
-                } else {
-                    wildcardFlag = false;
-                    if (t == 1) {
-                        oneFlag = true;
-                    } else {
-                        zeroFlag = true;
-                    }
-                }
-                if (oneFlag && zeroFlag) {
-                    break;
-                }
-            }
-            if (oneFlag && zeroFlag) {
-                break;
-            }
-            if (wildcardFlag) {
-                left[i] = -1;
-                break;
-            }
-            left[i]++;
-        }
-        bit.push_back(left[i]++);
-    }
-    return bit;
+    return NodeBitStatistics(node->classifier.data(), node->classifier.size()).SelectBits(node->left.data(), opt);
 }
 
-int T2Tree::CalculateLocation(const Rule& rule, const std::vector<int>& opt, const std::vector<int>& bit) {
+int T2Tree::CalculateLocation(const Rule& rule, const int* opt, const int* bit) {
     int loc = 0;
     
     for (int i = 0; i < maxBits; i++) {
@@ -1469,7 +2329,7 @@ int T2Tree::CalculateLocation(const Rule& rule, const std::vector<int>& opt, con
     return loc;
 }
 
-inline int T2Tree::CalculatePacketLocation(const Packet& p, const std::vector<int>& opt, const std::vector<int>& bit) {
+inline int T2Tree::CalculatePacketLocation(const PacketHeader& p, const std::vector<int>& opt, const std::vector<int>& bit) {
     static const std::vector<int> maxMask = {31, 31, 15, 15, 7};
     int loc = 0;
     
@@ -1490,6 +2350,7 @@ inline int T2Tree::CalculatePacketLocation(const Packet& p, const std::vector<in
 // T2Tree.cpp
 
 double T2Tree::AverageLeafDepth() const {
+    std::lock_guard<std::mutex> lock(updateMutex);
     long long sumDepth = 0;
     long long leafCount = 0;
     for (int i = 0; i < normalTreeCount; ++i) {
@@ -1510,6 +2371,7 @@ double T2Tree::AverageLeafDepth() const {
 }
 
 double T2Tree::AverageNodeBalance() const {
+    std::lock_guard<std::mutex> lock(updateMutex);
     long long nodeCount = 0;
     long double sumBalance = 0.0L;
 
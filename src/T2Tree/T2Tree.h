@@ -3,42 +3,64 @@
 
 #include "../ElementaryClasses.h"
 #include "WildcardRuleStorage.h"
+#include "CompiledT2Tree.h"
+#include "NodeBitStatistics.h"
+#include "TupleSpaceIndex.h"
+#include "RuleHandleTable.h"
+#include "TreeArena.h"
+#include "MemoryAccounting.h"
 #include <vector>
 #include <queue>
 #include <memory>
 #include <map>
+#include <array>
 #include <climits>
 #include <utility>
 #include <chrono>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
+static_assert(std::is_trivially_destructible<Rule>::value, "rules in a TreeArena are never destroyed");
+
+// A node of a master tree. Nodes live in their tree's TreeArena and are only freed with
+// it, all at once; everything a node holds is in that arena too, except its WRS, which the
+// arena destroys. Only leaves keep rules: an internal node drops its rule copy once the
+// rules are partitioned among its children and WRS.
 struct T2TreeNode {
-    std::vector<Rule> classifier;
+    TreeArena* arena;
+    ArenaVector<Rule> classifier;
     int nrules;
     int depth;
     bool isLeaf;
-    std::vector<int> opt, bit;
+    ArenaVector<int> opt, bit;
     
     bool hasWRS;
-    std::unique_ptr<WildcardRuleStorage> wrsNode;
+    WildcardRuleStorage* wrsNode;  // Owned by the arena
     int maxWRSPriority;
     
-    std::vector<T2TreeNode*> children;
+    ArenaVector<T2TreeNode*> children;
     T2TreeNode* parent;
-    std::vector<int> left;
+    ArenaVector<int> left;
     
     bool isOverflowTree;  // Not used
     int maxLeafPriority;
+    int maxSubtreePriority;  // Highest priority in this node's leaf, WRS and children, -1 if none
+    
+    uint32_t imageOffset;  // Word offset in the tree's compiled image, 0 = not compiled
 
-    T2TreeNode(const std::vector<Rule>& rules, int level = 0, bool isleaf = false) 
-        : nrules(static_cast<int>(rules.size())), depth(level), 
-          isLeaf(isleaf), hasWRS(false), wrsNode(nullptr), maxWRSPriority(-1), 
-          parent(nullptr), isOverflowTree(false), maxLeafPriority(-1) {
-        left = {0, 0, 0, 0, 0};
+    T2TreeNode(TreeArena* arena, const std::vector<Rule>& rules, int level = 0, bool isleaf = false) 
+        : arena(arena), classifier(ArenaAllocator<Rule>(arena)), nrules(static_cast<int>(rules.size())), depth(level), 
+          isLeaf(isleaf), opt(ArenaAllocator<int>(arena)), bit(ArenaAllocator<int>(arena)),
+          hasWRS(false), wrsNode(nullptr), maxWRSPriority(-1), 
+          children(ArenaAllocator<T2TreeNode*>(arena)), parent(nullptr), left(ArenaAllocator<int>(arena)),
+          isOverflowTree(false), maxLeafPriority(-1), maxSubtreePriority(-1), imageOffset(0) {
+        left.assign(MAXDIMENSIONS, 0);
         
-        classifier = rules;
+        classifier.assign(rules.begin(), rules.end());
         if (!classifier.empty()) {
             std::sort(classifier.begin(), classifier.end(), 
                 [](const Rule& a, const Rule& b) {
@@ -46,19 +68,32 @@ struct T2TreeNode {
                 });
             if (isLeaf) {
                 maxLeafPriority = classifier[0].priority;
+                maxSubtreePriority = maxLeafPriority;
             }
         }
     }
     
-    ~T2TreeNode() {
-        for (auto child : children) {
-            delete child;
+    // A node in the same arena as this one
+    T2TreeNode* newNode(const std::vector<Rule>& rules, int level, bool isleaf) const {
+        return arena->create<T2TreeNode>(arena, rules, level, isleaf);
+    }
+    
+    // Free the tree rooted here (root only): its whole arena goes at once
+    static void FreeTree(T2TreeNode* root) {
+        if (root) {
+            delete root->arena;
         }
     }
     
+    // Release the rules of an internal node once they are partitioned
+    void dropRules() {
+        ArenaVector<Rule>(classifier.get_allocator()).swap(classifier);
+        nrules = 0;
+    }
+    
     void createWRSIfBeneficial(int wildcardCount, int capacity = 8) {
         if (!hasWRS && wildcardCount >= capacity && depth >= 2 && depth <= 6) {
-            wrsNode = std::make_unique<WildcardRuleStorage>(capacity);
+            wrsNode = arena->make<WildcardRuleStorage>(capacity);
             hasWRS = true;
             maxWRSPriority = -1;
         }
@@ -66,7 +101,7 @@ struct T2TreeNode {
     
     void createWRSForOverflow(int capacity) {
         if (!hasWRS) {
-            wrsNode = std::make_unique<WildcardRuleStorage>(capacity);
+            wrsNode = arena->make<WildcardRuleStorage>(capacity);
             hasWRS = true;
             maxWRSPriority = -1;
         }
@@ -77,7 +112,6 @@ struct T2TreeNode {
             if (wrsNode->size() == 0) {
                 maxWRSPriority = -1;
             } else {
-                wrsNode->ensureSorted();
                 const auto& rules = wrsNode->getRules();
                 if (!rules.empty()) {
                     maxWRSPriority = rules[0].priority;
@@ -98,6 +132,41 @@ struct T2TreeNode {
         }
     }
     
+    // Insert into a leaf at its place in descending priority order, after rules of equal
+    // priority. Leaves are always kept sorted, so an update never re-sorts one.
+    void insertLeafRule(const Rule& rule) {
+        auto pos = std::upper_bound(classifier.begin(), classifier.end(), rule,
+            [](const Rule& a, const Rule& b) { return a.priority > b.priority; });
+        classifier.insert(pos, rule);
+        nrules++;
+        updateMaxLeafPriority();
+    }
+    
+    // Recompute maxSubtreePriority from this node's own rules and its children's bounds
+    void updateSubtreePriority() {
+        if (isLeaf) {
+            maxSubtreePriority = maxLeafPriority;
+            return;
+        }
+        maxSubtreePriority = hasWRS && wrsNode && wrsNode->size() > 0 ? maxWRSPriority : -1;
+        for (auto child : children) {
+            if (child) {
+                maxSubtreePriority = std::max(maxSubtreePriority, child->maxSubtreePriority);
+            }
+        }
+    }
+    
+    // Bottom-up recompute of every bound in the subtree, returns this node's
+    int computeSubtreePriority() {
+        for (auto child : children) {
+            if (child) {
+                child->computeSubtreePriority();
+            }
+        }
+        updateSubtreePriority();
+        return maxSubtreePriority;
+    }
+    
     int getDepth() const {
         if (isLeaf) return depth;
         int maxChildDepth = depth;
@@ -116,6 +185,17 @@ struct UpdateStatistics {
     uint32_t deleteAttempts = 0;
     uint32_t deleteSuccesses = 0;
     
+    // Wall-clock latency of the batches applied (performBatchUpdate and large stable updates)
+    uint32_t batches = 0;
+    double batchSeconds = 0.0;
+    double maxBatchSeconds = 0.0;
+    
+    void recordBatch(double seconds) {
+        batches++;
+        batchSeconds += seconds;
+        maxBatchSeconds = std::max(maxBatchSeconds, seconds);
+    }
+    
     void printSummary() const {
         printf("\tInsert success rate: %u/%u (%.1f%%)\n", 
                insertSuccesses, insertAttempts, 
@@ -125,37 +205,141 @@ struct UpdateStatistics {
                deleteAttempts > 0 ? (100.0 * deleteSuccesses / deleteAttempts) : 0.0);
         printf("\tTotal updates: %u rules update: insert_num = %u delete_num = %u\n",
                insertAttempts + deleteAttempts, insertSuccesses, deleteSuccesses);
+        if (batches > 0) {
+            printf("\tBatch latency: %.3f ms average, %.3f ms worst over %u batches\n",
+                   batchSeconds * 1e3 / batches, maxBatchSeconds * 1e3, batches);
+        }
     }
 };
 
 // Overflow container
 class HybridOverflowContainer {
+public:
+    // Immutable lookup state, published as a whole by publish(). Lookups read only this.
+    struct View {
+        std::vector<TupleSpaceIndex> layers;                              // One per tuple, highest priority first
+        std::vector<std::shared_ptr<const std::vector<uint32_t>>> owners;  // Keep layers alive, empty when mapped
+        size_t size = 0;
+        int maxPriority = -1;
+        
+        int search(const PacketHeader& packet, int currentBest) const;
+    };
+    
 private:
-    struct PriorityLayer {
-        int minPriority;
-        int maxPriority;
+    typedef std::array<uint32_t, MAXDIMENSIONS> TupleMask;
+    
+    // Rules sharing one tuple, indexed on their own so an update only re-indexes its tuple
+    struct TupleGroup {
         std::vector<Rule> rules;
-        bool sorted = false;
-        
-        PriorityLayer(int min = 0, int max = 0) 
-            : minPriority(min), maxPriority(max), sorted(false) {}
+        int maxPriority = -1;
+        std::shared_ptr<const std::vector<uint32_t>> index;  // Lookup copy, shared with published views
+        bool dirty = true;                                    // rules changed since index was built
+    };
+    
+    std::map<TupleMask, TupleGroup> tuples;
+    static constexpr size_t MIN_TUPLE_RULES = 64;  // Smaller tuples share the catch-all group
+    // Where each rule sits: its group, and its slot in the group's rules so a remove can
+    // swap the last rule into the hole instead of searching the group
+    struct RuleSlot {
+        TupleMask mask;
+        size_t slot;
     };
+    std::unordered_map<int, RuleSlot> ruleIdToTuple;
+    size_t ruleCount = 0;
+    uint64_t changeCount = 0;
+    
+    std::atomic<const View*> published;
+    bool stale = false;  // Something changed since the last publish()
     
-    std::vector<PriorityLayer> layers;
-    std::unordered_map<int, size_t> ruleIdToLayer;
-    static constexpr int LAYER_SIZE = 10000;
+    static TupleMask maskOf(const Rule& rule);
     
 public:
+    HybridOverflowContainer();
+    ~HybridOverflowContainer();
+    HybridOverflowContainer(const HybridOverflowContainer&) = delete;
+    HybridOverflowContainer& operator=(const HybridOverflowContainer&) = delete;
+    
     void insert(const Rule& rule);
     bool remove(int rule_id);
-    int search(const Packet& packet, int currentBest = -1) const;
-    size_t size() const;
+    int search(const PacketHeader& packet, int currentBest = -1) const { return view()->search(packet, currentBest); }
+    // Re-index changed tuples and publish a new View; insert/remove only change the master
+    // rules, so searches see them after the next publish(). The previous View is retired
+    // through the EpochReclaimer, which keeps concurrent searches safe.
+    void publish();
+    const View* view() const { return published.load(std::memory_order_acquire); }
+    // Publish tuple indexes that live in external memory (a mapped snapshot)
+    void publishMapped(const std::vector<TupleSpaceIndex>& indexes, size_t size, int maxPriority);
+    size_t size() const { return ruleCount; }
+    // Append every rule held (master copy) to rules
+    void collectRules(std::vector<Rule>& rules) const;
+    // Master copy of a rule, nullptr if the id is not held
+    const Rule* find(int rule_id) const;
+    // Bumped by every insert/remove/clear, so a reader of the master rules can tell they moved
+    uint64_t changes() const { return changeCount; }
     void clear();
-    Memory memoryUsage() const;
+    // Heap bytes of the rule groups and their tuple indexes (including the published view),
+    // and of the rule id -> slot hash
+    size_t layerMemoryUsage() const;
+    size_t idIndexMemoryUsage() const;
+    Memory memoryUsage() const { return static_cast<Memory>(layerMemoryUsage() + idIndexMemoryUsage()); }
     void optimize();
     int getMaxPriority() const;  // Get maximum priority
 };
 
+// Shape of one tree, compared against the same figures taken right after it was built
+struct TreeHealth {
+    int rules = 0;
+    int leaves = 0;
+    int overfullLeaves = 0;  // Leaves holding more than binth rules
+    int wrsRules = 0;
+    int wrsCapacity = 0;
+    
+    double OverfullShare() const { return leaves ? static_cast<double>(overfullLeaves) / leaves : 0.0; }
+    double WRSFill() const { return wrsCapacity ? static_cast<double>(wrsRules) / wrsCapacity : 0.0; }
+};
+
+// Bytes one tree holds, measured from what is actually allocated
+struct TreeMemory {
+    size_t internalNodes = 0;  // Internal node records and their partition and child vectors
+    size_t leaves = 0;         // Leaf node records and their rules
+    size_t wrs = 0;            // WRS objects with their rules and indexes
+    size_t arenaSlack = 0;     // Arena memory not in use: free lists and chunk tails
+    size_t image = 0;          // Compiled search image
+    
+    size_t Total() const { return internalNodes + leaves + wrs + arenaSlack + image; }
+    void Add(const TreeMemory& other);
+};
+
+// Where the classifier's memory goes. Every figure but modelBytes counts real allocations:
+// container capacities, hash nodes and bucket arrays, arena chunks, with the allocator's own
+// rounding. modelBytes is the hardware-model estimate of MemSizeBytes(), kept for
+// comparison with the published numbers.
+struct MemoryReport {
+    std::vector<TreeMemory> trees;
+    size_t overflowLayers = 0;    // Overflow rule groups and their tuple indexes
+    size_t overflowIdIndex = 0;   // Overflow rule id -> slot hash
+    size_t ruleIndex = 0;         // Rule handle table
+    size_t updateBuffers = 0;     // Deferred deletes
+    size_t snapshotMapping = 0;   // Mapped snapshot file
+    size_t modelBytes = 0;
+    
+    TreeMemory TreeTotal() const;
+    size_t Total() const;
+    void Print() const;
+};
+
+// When RebuildDegraded() rebuilds part of the structure. Every figure is measured against
+// the state right after the last build of that part, so a rule set that is naturally hard
+// to partition does not keep triggering rebuilds.
+struct RebuildPolicy {
+    size_t minOverflowGrowth = 256;     // Overflow rules gained before re-absorbing them...
+    double overflowGrowthShare = 0.25;  // ...and at least this share of the post-build overflow
+    double overfullLeafGrowth = 0.10;   // Rise in the share of a tree's leaves above binth
+    double wrsDrain = 0.25;             // Drop in a tree's WRS fill (deleted wildcard rules)
+    int minAbsorbedRules = 0;           // Net rules a re-absorption must take off the overflow,
+                                        // 0 = binth
+};
+
 enum RuleType {
     SPECIFIC_RULE,
     WILDCARD_RULE
@@ -167,12 +351,53 @@ public:
     ~T2Tree() override;
     
     void ConstructClassifier(const std::vector<Rule>& rules) override;
-    int ClassifyAPacket(const Packet& packet) override;
+    using PacketClassifier::ClassifyAPacket;  // Packet adapter
+    int ClassifyAPacket(const PacketHeader& packet) override;
+    // Classify n packets; out[k] receives the same priority ClassifyAPacket(pkts[k]) would return
+    void ClassifyBatch(const PacketHeader* pkts, size_t n, int* out);
+    
+    // Read-only lookups: any number of threads may call these concurrently on one instance,
+    // each passing its own stats. Updates must not run at the same time.
+    int Classify(const PacketHeader& packet, LookupStats& stats) const;
+    void ClassifyBatch(const PacketHeader* pkts, size_t n, int* out, LookupStats& stats) const;
+    
+    // Copy-on-write update mode: updates publish new node versions with single atomic
+    // stores and retire replaced ones through the EpochReclaimer, so lookups may run on
+    // other threads during InsertRule/DeleteRule. Update calls are serialized internally.
+    void EnableConcurrentUpdates(bool enable);
+    
+    // Binary snapshot of the built structure (layout in T2TreeSnapshot.h). LoadSnapshot maps
+    // the file and serves lookups straight from it, without rebuilding; the loaded instance
+    // is lookup-only. Both print the reason and return false on failure.
+    bool SaveSnapshot(const char* path) const;
+    bool LoadSnapshot(const char* path);
+    bool IsSnapshot() const { return snapshotBase != nullptr; }
+    // Checksum of the snapshot this instance would write; equal builds give equal fingerprints
+    uint64_t Fingerprint() const;
+    
+    // Threads used to score candidate partitions in ConstructClassifier, 0 = OpenMP default.
+    // The built structure does not depend on the thread count.
+    void SetBuildThreads(int threads) { buildThreads = threads; }
     
     void DeleteRule(const Rule& delete_rule) override;
     void InsertRule(const Rule& insert_rule) override;
     
-    Memory MemSizeBytes() const override;
+    // Degradation repair. Inserts that miss the trees pile up in the overflow container and
+    // leaves grow past binth, so lookups slow down under churn. RebuildDegraded() takes one
+    // step: it moves grown overflow back into a new tree (or into the smallest tree once
+    // maxTreeNum is reached), or rebuilds the most degraded tree from its own rules. The
+    // tree is built off the writer lock, so updates keep flowing, and swapped in with
+    // atomic publishes that lookups never observe half done. Returns true if it swapped.
+    bool RebuildDegraded();
+    // Run RebuildDegraded() every interval on a background thread until stopped
+    void StartBackgroundRebuild(std::chrono::milliseconds interval);
+    void StopBackgroundRebuild();
+    void SetRebuildPolicy(const RebuildPolicy& policy);
+    size_t RebuildCount() const { return rebuildCount.load(std::memory_order_relaxed); }
+    TreeHealth GetTreeHealth(size_t tree) const;
+    
+    Memory MemSizeBytes() const override;  // Hardware-model estimate
+    MemoryReport GetMemoryReport() const;  // Measured, by component
     size_t NumTables() const override;
     size_t RulesInTable(size_t tableIndex) const override { 
         (void)tableIndex;
@@ -185,8 +410,8 @@ public:
     size_t GetOverflowRuleCount() const;
 
     std::vector<int> GetSelectBit(T2TreeNode* node, std::vector<int>& opt);
-    int CalculateLocation(const Rule& rule, const std::vector<int>& opt, const std::vector<int>& bit);
-    inline int CalculatePacketLocation(const Packet& p, const std::vector<int>& opt, const std::vector<int>& bit);
+    int CalculateLocation(const Rule& rule, const int* opt, const int* bit);
+    inline int CalculatePacketLocation(const PacketHeader& p, const std::vector<int>& opt, const std::vector<int>& bit);
     
     bool DeleteRuleSimple(const Rule& delete_rule);
     bool InsertRuleConservative(const Rule& insert_rule);
@@ -195,8 +420,62 @@ public:
     UpdateStatistics performBatchUpdate(const std::vector<Rule>& rules, const std::vector<int>& operations);
 
 private:
-    std::vector<Rule> classifier;
+    UpdateStatistics applyBatchUpdate(const std::vector<Rule>& rules, const std::vector<int>& operations);
+
     std::vector<T2TreeNode*> roots;
+    std::vector<CompiledT2Tree> images;  // Search images of roots, the only structure lookups read
+    bool concurrentUpdates = false;
+    
+    // Mapped snapshot backing images and overflow layers, nullptr when built in memory
+    const uint8_t* snapshotBase = nullptr;
+    size_t snapshotBytes = 0;
+    void releaseSnapshot();
+    void serializeSnapshot(std::vector<uint8_t>& file) const;
+    bool rejectUpdate() const;
+    
+    // Serializes writers: the public update entry points and the rebuild steps. Lookups
+    // never take it.
+    mutable std::mutex updateMutex;
+    
+    // Degradation repair state, guarded by updateMutex
+    RebuildPolicy rebuildPolicy;
+    std::vector<TreeHealth> builtHealth;     // Per tree, right after it was built
+    size_t builtOverflow = 0;                // Overflow size after the last build or absorb
+    std::vector<uint64_t> treeVersion;       // Bumped on every change to a tree
+    uint64_t constructions = 0;              // Bumped by ConstructClassifier
+    std::atomic<size_t> rebuildCount{0};
+    
+    int rebuildingTree = -1;                 // Tree being rebuilt off-lock, inserts avoid it
+    
+    // A rebuild planned under the lock and built without it
+    struct RebuildJob {
+        int tree = -1;                        // Tree replaced, or normalTreeCount for a new one
+        int binth = 0;
+        std::vector<Rule> rules;              // Input, sorted by descending priority
+        std::unordered_set<int> fromOverflow; // Ids of input rules taken from the overflow
+        uint64_t treeVersion = 0, overflowChanges = 0, constructions = 0;
+    };
+    static constexpr int MAX_OPTIMISTIC_REBUILDS = 2;  // Then the build holds the lock
+    bool planRebuild(RebuildJob& job);
+    bool jobCurrent(const RebuildJob& job) const;
+    T2TreeNode* buildDetached(const RebuildJob& job, std::vector<Rule>& kickedRules) const;
+    bool commitRebuild(const RebuildJob& job, T2TreeNode* root, const std::vector<Rule>& kickedRules);
+    TreeHealth healthOf(const T2TreeNode* root) const;
+    Memory modelMemory() const;
+    TreeMemory measureTree(size_t tree) const;
+    void recordBuiltHealth();
+    
+    std::thread rebuildThread;
+    std::mutex rebuildWakeMutex;
+    std::condition_variable rebuildWake;
+    bool rebuildStop = false;
+    
+    int buildThreads = 0;
+    // Nodes smaller than this score their candidate partitions on one thread
+    static constexpr int PARALLEL_BUILD_MIN_RULES = 2048;
+    // Upper bound on rules parked in one node's WRS during construction (binth also caps it)
+    static constexpr int WRS_MAX_CAPACITY = 64;
+    static int BuildThreadCount(int requested);
     
     int maxBits;
     int maxLevel;
@@ -206,35 +485,33 @@ private:
     std::vector<std::vector<int>> partitionOpt;
     std::vector<int> Maxpri;
     
-    uint64_t Query;
-    
-    std::vector<std::pair<int, size_t>> treeSearchOrder;
+    // (Maxpri, tree) pairs in search order, replaced as a whole by buildTreeSearchOrder()
+    // or updateTreeMaxpri()
+    typedef std::vector<std::pair<int, size_t>> SearchOrder;
+    std::atomic<const SearchOrder*> treeSearchOrder{new SearchOrder()};
     
     // Overflow management
     int normalTreeCount;
     HybridOverflowContainer hybridOverflowContainer;
     int overflowMaxPriority = -1;  // Record maximum priority of overflow container
     
-    // Rule index
-    std::vector<int8_t> ruleTreeIndex;
-    int maxRuleId;
+    // Rule index: the tree of each rule and, for tree rules, its leaf or the internal node
+    // whose WRS has it. Lets a delete go straight to the rule instead of descending again.
+    static constexpr int OVERFLOW_TREE = RuleHandleTable::OVERFLOW_TREE;
+    RuleHandleTable ruleIndex;
     
     // Update buffer
     struct UpdateBuffer {
-        std::vector<Rule> recentInserts;
         std::unordered_set<int> pendingDeletes;
         int lastSuccessfulTree = 0;
         
         void clear() {
-            if (recentInserts.size() > 1000) {
-                recentInserts.erase(recentInserts.begin(), 
-                                   recentInserts.begin() + recentInserts.size() - 100);
-            }
             pendingDeletes.clear();
         }
     } updateBuffer;
     
     // Core functions
+    T2TreeNode* buildTree(const std::vector<Rule>& rules, std::vector<Rule>& kickedRules, int treeIndex);
     T2TreeNode* CreateSubT2TreeBalancedOptimized(const std::vector<Rule>& rules, 
                                                  std::vector<Rule>& kickedRules, 
                                                  int treeIndex);
@@ -248,8 +525,19 @@ private:
     void extractAllRulesFromTree(T2TreeNode* root, std::vector<Rule>& rules);
     
     void buildTreeSearchOrder();
-    int SearchUltraFastTwoPhase(T2TreeNode* root, const Packet& p, int currentBest);
-    int searchLeafComplete(T2TreeNode* leafNode, const Packet& p, int currentBest = -1);
+    void updateTreeMaxpri(int treeIdx);
+    int classify(const PacketHeader& packet, uint64_t& query) const;
+    int SearchUltraFastTwoPhase(const ImageView& image, const PacketHeader& p, int currentBest,
+                                uint64_t& query) const;
+    int searchLeafComplete(const ImageLeafNode* leafNode, const PacketHeader& p, int currentBest = -1) const;
+    
+    // Compiled images
+    void compileSearchImages();
+    void publishNode(T2TreeNode* node);
+    
+    // Batch search: packets of a group descend each tree level by level, interleaved
+    static constexpr size_t BATCH_GROUP = 16;
+    void classifyGroup(const PacketHeader* pkts, size_t n, int* out, uint64_t* query) const;
     
     // Update functions
     bool InsertRuleOptimized(const Rule& insert_rule);
@@ -259,7 +547,18 @@ private:
     bool insertToOverflowDirect(const Rule& rule);
     bool tryFastInsert(T2TreeNode* root, const Rule& rule);
     bool deleteFromKnownLocation(const Rule& rule, int treeIdx);
-    bool batchDelete(const std::vector<Rule>& rules);
+    bool removeTreeRule(const Rule& rule, int treeIdx);
+    bool removeFromNode(T2TreeNode* node, const Rule& rule);
+    void indexTreeRules(T2TreeNode* root);
+    void setRuleNode(int ruleId, T2TreeNode* node) {
+        ruleIndex.at(ruleId).node = node;
+    }
+    // Batch pipeline: operations are grouped by node and changed nodes published together
+    size_t batchDelete(const std::vector<Rule>& rules, std::vector<T2TreeNode*>& changed);
+    size_t batchInsert(const std::vector<Rule>& rules, std::vector<T2TreeNode*>& changed);
+    T2TreeNode* locateInsertLeaf(T2TreeNode* root, const Rule& rule,
+                                 const std::unordered_map<T2TreeNode*, std::vector<Rule>>& pending);
+    void publishNodes(const std::vector<T2TreeNode*>& nodes);
     void processPendingDeletes();
     int getTreeDepth(T2TreeNode* root) const;
     
@@ -273,9 +572,8 @@ private:
     bool DeleteRuleCompatible(const Rule& delete_rule);
     bool tryCompatibleInsert(T2TreeNode* root, const Rule& insert_rule);
     bool tryCompatibleDelete(T2TreeNode* root, const Rule& delete_rule);
-    int recalculateTreeMaxPriority(T2TreeNode* root);
     
-    bool hasWildcardInSelectedBits(const Rule& rule, const std::vector<int>& opt, const std::vector<int>& bit);
+    bool hasWildcardInSelectedBits(const Rule& rule, const int* opt, const int* bit);
     int getBalancedAggressiveLeafCapacity(int remainingRules, int treeIndex);
     int countRuleWildcards(const Rule& rule) const;
 };
@@ -0,0 +1,307 @@
+#include "T2TreeSnapshot.h"
+#include "T2Tree.h"
+#include "EpochReclaimer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t SnapshotChecksum(const uint8_t* data, size_t bytes, uint64_t hash) {
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    if (i < bytes) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, bytes - i);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Checksum of a whole snapshot file, the header read with its checksum field zeroed
+static uint64_t FileChecksum(const uint8_t* file, size_t bytes) {
+    SnapshotHeader header;
+    memcpy(&header, file, sizeof(header));
+    header.checksum = 0;
+    uint64_t hash = SnapshotChecksum(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    return SnapshotChecksum(file + sizeof(header), bytes - sizeof(header), hash);
+}
+
+static size_t AlignUp(size_t n) {
+    return (n + T2_SNAPSHOT_ALIGN - 1) & ~static_cast<size_t>(T2_SNAPSHOT_ALIGN - 1);
+}
+
+// ========== Save ==========
+void T2Tree::serializeSnapshot(std::vector<uint8_t>& file) const {
+    EpochGuard guard;
+    std::lock_guard<std::mutex> lock(updateMutex);
+    const SearchOrder* order = treeSearchOrder.load(std::memory_order_acquire);
+    const HybridOverflowContainer::View* overflow = hybridOverflowContainer.view();
+
+    // Collect payloads first so the section table can be laid out in one pass
+    struct Payload {
+        uint32_t kind;
+        uint32_t index;
+        const void* data;
+        size_t bytes;
+    };
+    std::vector<Payload> payloads;
+
+    std::vector<SnapshotOrderEntry> orderEntries;
+    for (const auto& entry : *order) {
+        orderEntries.push_back({entry.first, static_cast<uint32_t>(entry.second)});
+    }
+    payloads.push_back({SECTION_SEARCH_ORDER, 0, orderEntries.data(), orderEntries.size() * sizeof(SnapshotOrderEntry)});
+    for (size_t i = 0; i < images.size(); i++) {
+        payloads.push_back({SECTION_IMAGE, static_cast<uint32_t>(i), images[i].View().words,
+                            images[i].SizeWords() * sizeof(uint32_t)});
+    }
+    for (size_t i = 0; i < overflow->layers.size(); i++) {
+        const TupleSpaceIndex& layer = overflow->layers[i];
+        payloads.push_back({SECTION_OVERFLOW_LAYER, static_cast<uint32_t>(i), layer.words,
+                            layer.Words() * sizeof(uint32_t)});
+    }
+    std::vector<SnapshotRuleEntry> ruleEntries;
+    ruleEntries.reserve(ruleIndex.size());
+    ruleIndex.forEach([&ruleEntries](int id, const RuleHandleTable::Location& loc) {
+        ruleEntries.push_back({id, loc.tree});
+    });
+    std::sort(ruleEntries.begin(), ruleEntries.end(),
+        [](const SnapshotRuleEntry& a, const SnapshotRuleEntry& b) { return a.id < b.id; });
+    payloads.push_back({SECTION_RULE_INDEX, 0, ruleEntries.data(), ruleEntries.size() * sizeof(SnapshotRuleEntry)});
+    payloads.push_back({SECTION_TREE_MAXPRI, 0, Maxpri.data(), Maxpri.size() * sizeof(int)});
+
+    size_t offset = AlignUp(sizeof(SnapshotHeader) + payloads.size() * sizeof(SnapshotSection));
+    std::vector<SnapshotSection> sections;
+    for (const auto& payload : payloads) {
+        sections.push_back({payload.kind, payload.index, offset, payload.bytes});
+        offset = AlignUp(offset + payload.bytes);
+    }
+
+    file.assign(offset, 0);
+    SnapshotHeader* header = reinterpret_cast<SnapshotHeader*>(file.data());
+    memcpy(header->magic, T2_SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = T2_SNAPSHOT_VERSION;
+    header->dimensions = MAXDIMENSIONS;
+    header->fileBytes = file.size();
+    header->sectionCount = static_cast<uint32_t>(sections.size());
+    header->maxBits = maxBits;
+    header->maxLevel = maxLevel;
+    header->binth = binth;
+    header->maxTreeNum = maxTreeNum;
+    header->wrsThreshold = wrsThreshold;
+    header->normalTreeCount = normalTreeCount;
+    header->indexedRules = static_cast<uint32_t>(ruleEntries.size());
+    header->overflowMaxPriority = overflow->maxPriority;
+    header->overflowLayers = static_cast<uint32_t>(overflow->layers.size());
+    header->overflowRules = overflow->size;
+
+    memcpy(file.data() + sizeof(SnapshotHeader), sections.data(), sections.size() * sizeof(SnapshotSection));
+    for (size_t i = 0; i < payloads.size(); i++) {
+        if (payloads[i].bytes) {
+            memcpy(file.data() + sections[i].offset, payloads[i].data, payloads[i].bytes);
+        }
+    }
+    header->checksum = FileChecksum(file.data(), file.size());
+}
+
+bool T2Tree::SaveSnapshot(const char* path) const {
+    std::vector<uint8_t> file;
+    serializeSnapshot(file);
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        printf("Cannot open snapshot %s for writing\n", path);
+        return false;
+    }
+    bool ok = fwrite(file.data(), 1, file.size(), fp) == file.size();
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        printf("Failed to write snapshot %s\n", path);
+    }
+    return ok;
+}
+
+uint64_t T2Tree::Fingerprint() const {
+    std::vector<uint8_t> file;
+    serializeSnapshot(file);
+    return reinterpret_cast<const SnapshotHeader*>(file.data())->checksum;
+}
+
+// ========== Load ==========
+void T2Tree::releaseSnapshot() {
+    if (!snapshotBase) return;
+#ifdef _WIN32
+    free(const_cast<uint8_t*>(snapshotBase));
+#else
+    munmap(const_cast<uint8_t*>(snapshotBase), snapshotBytes);
+#endif
+    snapshotBase = nullptr;
+    snapshotBytes = 0;
+}
+
+static const uint8_t* MapSnapshotFile(const char* path, size_t& bytes) {
+#ifdef _WIN32
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return nullptr;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t* buffer = size > 0 ? static_cast<uint8_t*>(malloc(size)) : nullptr;
+    if (!buffer || fread(buffer, 1, size, fp) != static_cast<size_t>(size)) {
+        free(buffer);
+        fclose(fp);
+        return nullptr;
+    }
+    fclose(fp);
+    bytes = static_cast<size_t>(size);
+    return buffer;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* base = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return nullptr;
+    bytes = static_cast<size_t>(st.st_size);
+    return static_cast<const uint8_t*>(base);
+#endif
+}
+
+bool T2Tree::LoadSnapshot(const char* path) {
+    if (snapshotBase || !roots.empty() || !images.empty()) {
+        printf("LoadSnapshot needs a freshly constructed T2Tree\n");
+        return false;
+    }
+
+    size_t bytes = 0;
+    const uint8_t* base = MapSnapshotFile(path, bytes);
+    if (!base) {
+        printf("Cannot map snapshot %s\n", path);
+        return false;
+    }
+    snapshotBase = base;
+    snapshotBytes = bytes;
+
+    auto fail = [&](const char* reason) {
+        printf("Invalid snapshot %s: %s\n", path, reason);
+        releaseSnapshot();
+        return false;
+    };
+
+    if (bytes < sizeof(SnapshotHeader)) return fail("truncated header");
+    const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(base);
+    if (memcmp(header->magic, T2_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) return fail("bad magic");
+    if (header->version != T2_SNAPSHOT_VERSION) return fail("unsupported version");
+    if (header->dimensions != MAXDIMENSIONS) return fail("dimension mismatch");
+    if (header->fileBytes != bytes) return fail("size mismatch");
+    if (header->sectionCount > (bytes - sizeof(SnapshotHeader)) / sizeof(SnapshotSection)) return fail("bad section table");
+    if (FileChecksum(base, bytes) != header->checksum) return fail("checksum mismatch");
+    // Every tree image and overflow layer has its own section, next to the three fixed ones
+    if (header->normalTreeCount < 0 ||
+        static_cast<uint64_t>(header->normalTreeCount) + header->overflowLayers + 3 > header->sectionCount) {
+        return fail("bad header");
+    }
+
+    const SnapshotSection* sections = reinterpret_cast<const SnapshotSection*>(base + sizeof(SnapshotHeader));
+    const SnapshotSection* orderSection = nullptr;
+    const SnapshotSection* ruleIndexSection = nullptr;
+    const SnapshotSection* maxpriSection = nullptr;
+    std::vector<const SnapshotSection*> imageSections(header->normalTreeCount, nullptr);
+    std::vector<TupleSpaceIndex> overflowLayers(header->overflowLayers, TupleSpaceIndex{nullptr});
+
+    for (uint32_t i = 0; i < header->sectionCount; i++) {
+        const SnapshotSection& section = sections[i];
+        if (section.offset % T2_SNAPSHOT_ALIGN != 0 || section.offset > bytes || section.bytes > bytes - section.offset) {
+            return fail("section out of bounds");
+        }
+        switch (section.kind) {
+        case SECTION_SEARCH_ORDER: orderSection = &section; break;
+        case SECTION_RULE_INDEX: ruleIndexSection = &section; break;
+        case SECTION_TREE_MAXPRI: maxpriSection = &section; break;
+        case SECTION_IMAGE:
+            if (section.index >= imageSections.size() || section.bytes % sizeof(uint32_t) != 0 ||
+                !CompiledT2Tree::Validate(reinterpret_cast<const uint32_t*>(base + section.offset),
+                                          section.bytes / sizeof(uint32_t))) {
+                return fail("bad image section");
+            }
+            imageSections[section.index] = &section;
+            break;
+        case SECTION_OVERFLOW_LAYER: {
+            const uint32_t* words = reinterpret_cast<const uint32_t*>(base + section.offset);
+            if (section.index >= overflowLayers.size() || section.bytes % sizeof(uint32_t) != 0 ||
+                !TupleSpaceIndex::Validate(words, section.bytes / sizeof(uint32_t))) {
+                return fail("bad overflow index");
+            }
+            overflowLayers[section.index].words = words;
+            break;
+        }
+        default:
+            return fail("unknown section");
+        }
+    }
+    if (!orderSection || !ruleIndexSection || !maxpriSection) return fail("missing section");
+    for (const auto* section : imageSections) {
+        if (!section) return fail("missing image");
+    }
+    for (const TupleSpaceIndex& layer : overflowLayers) {
+        if (!layer.words) return fail("missing overflow layer");
+    }
+    if (orderSection->bytes % sizeof(SnapshotOrderEntry) != 0 || maxpriSection->bytes % sizeof(int) != 0 ||
+        ruleIndexSection->bytes != header->indexedRules * sizeof(SnapshotRuleEntry)) {
+        return fail("bad section size");
+    }
+
+    // Everything checked; nothing below can fail
+    maxBits = header->maxBits;
+    maxLevel = header->maxLevel;
+    binth = header->binth;
+    maxTreeNum = header->maxTreeNum;
+    wrsThreshold = header->wrsThreshold;
+    normalTreeCount = header->normalTreeCount;
+    overflowMaxPriority = header->overflowMaxPriority;
+
+    roots.assign(normalTreeCount, nullptr);
+    images.resize(normalTreeCount);
+    for (int i = 0; i < normalTreeCount; i++) {
+        images[i].Map(reinterpret_cast<const uint32_t*>(base + imageSections[i]->offset),
+                      imageSections[i]->bytes / sizeof(uint32_t));
+    }
+
+    // Mapped trees have no nodes, so only the tree of each rule is restored
+    const SnapshotRuleEntry* ruleEntries = reinterpret_cast<const SnapshotRuleEntry*>(base + ruleIndexSection->offset);
+    ruleIndex.clear();
+    ruleIndex.reserve(header->indexedRules);
+    for (uint32_t i = 0; i < header->indexedRules; i++) {
+        ruleIndex.at(ruleEntries[i].id).tree = ruleEntries[i].tree;
+    }
+    const int* maxpri = reinterpret_cast<const int*>(base + maxpriSection->offset);
+    Maxpri.assign(maxpri, maxpri + maxpriSection->bytes / sizeof(int));
+
+    SearchOrder* order = new SearchOrder();
+    const SnapshotOrderEntry* entries = reinterpret_cast<const SnapshotOrderEntry*>(base + orderSection->offset);
+    for (size_t i = 0; i < orderSection->bytes / sizeof(SnapshotOrderEntry); i++) {
+        if (static_cast<int>(entries[i].tree) < normalTreeCount) {
+            order->push_back({entries[i].maxPriority, entries[i].tree});
+        }
+    }
+    const SearchOrder* old = treeSearchOrder.exchange(order, std::memory_order_acq_rel);
+    EpochReclaimer::Retire([old]() { delete old; });
+
+    hybridOverflowContainer.publishMapped(overflowLayers, header->overflowRules, overflowMaxPriority);
+    return true;
+}
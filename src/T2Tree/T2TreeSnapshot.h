@@ -0,0 +1,67 @@
+#ifndef T2_TREE_SNAPSHOT_H
+#define T2_TREE_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstddef>
+
+// On-disk layout written by T2Tree::SaveSnapshot and mapped by T2Tree::LoadSnapshot:
+//
+//   SnapshotHeader | SnapshotSection[sectionCount] | payloads, each T2_SNAPSHOT_ALIGN aligned
+//
+// Integers are stored in host byte order; a snapshot is loaded on the kind of machine that
+// wrote it. Image and overflow payloads are stored exactly as the lookup path reads them
+// (CompiledT2Tree and TupleSpaceIndex words), so a mapped file is searched in place. The
+// checksum covers the whole file, the header included with its checksum field read as zero.
+#define T2_SNAPSHOT_MAGIC "T2TSNAP"
+#define T2_SNAPSHOT_VERSION 6
+#define T2_SNAPSHOT_ALIGN 64
+
+enum SnapshotSectionKind : uint32_t {
+    SECTION_SEARCH_ORDER = 1,    // SnapshotOrderEntry per searched tree
+    SECTION_IMAGE = 2,           // Compiled image of tree `index`
+    SECTION_OVERFLOW_LAYER = 3,  // TupleSpaceIndex of overflow layer `index`, highest priority first
+    SECTION_RULE_INDEX = 4,      // SnapshotRuleEntry per indexed rule, by ascending id
+    SECTION_TREE_MAXPRI = 5      // int32_t Maxpri per tree
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dimensions;         // MAXDIMENSIONS of the writer, fixes the rule block layout
+    uint64_t fileBytes;
+    uint64_t checksum;
+    uint32_t sectionCount;
+    int32_t maxBits;
+    int32_t maxLevel;
+    int32_t binth;
+    int32_t maxTreeNum;
+    int32_t wrsThreshold;
+    int32_t normalTreeCount;
+    uint32_t indexedRules;
+    int32_t overflowMaxPriority;
+    uint32_t overflowLayers;
+    uint64_t overflowRules;
+};
+
+struct SnapshotSection {
+    uint32_t kind;
+    uint32_t index;
+    uint64_t offset;             // From the start of the file
+    uint64_t bytes;
+};
+
+struct SnapshotOrderEntry {
+    int32_t maxPriority;
+    uint32_t tree;
+};
+
+struct SnapshotRuleEntry {
+    int32_t id;
+    int32_t tree;                // Tree index, or RuleHandleTable::OVERFLOW_TREE
+};
+
+// FNV-1a over 64-bit words (the tail is zero-padded), continuing from hash
+#define T2_SNAPSHOT_CHECKSUM_SEED 1469598103934665603ULL
+uint64_t SnapshotChecksum(const uint8_t* data, size_t bytes, uint64_t hash = T2_SNAPSHOT_CHECKSUM_SEED);
+
+#endif // T2_TREE_SNAPSHOT_H
@@ -0,0 +1,159 @@
+#include "TraceStream.h"
+#include "ClassBenchParser.h"
+#include "MemoryAccounting.h"
+#include <cstring>
+
+TraceStream::TraceStream(size_t chunkPackets) : chunkPackets(chunkPackets > 0 ? chunkPackets : 1) {}
+
+TraceStream::~TraceStream() {
+    Close();
+}
+
+bool TraceStream::Open(const char* path) {
+    Close();
+    fp = fopen(path, "rb");
+    if (!fp) {
+        printf("Cannot open trace file %s\n", path);
+        return false;
+    }
+    setvbuf(fp, nullptr, _IONBF, 0);  // Reads land in text directly
+
+    text.resize(READ_BYTES);
+    textBegin = textEnd = 0;
+    line = 1;
+    eof = false;
+    for (Chunk& chunk : chunks) {
+        chunk.packets.resize(chunkPackets);
+        chunk.count = 0;
+        chunk.ready = false;
+    }
+    nextChunk = 0;
+    heldChunk = -1;
+    finished = stopping = failed = false;
+    worker = std::thread(&TraceStream::prefetch, this);
+    return true;
+}
+
+void TraceStream::Close() {
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+    }
+    if (fp) {
+        fclose(fp);
+        fp = nullptr;
+    }
+}
+
+bool TraceStream::Next(const PacketHeader*& packets, size_t& count) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (heldChunk >= 0) {
+        chunks[heldChunk].ready = false;
+        heldChunk = -1;
+        changed.notify_all();
+    }
+    Chunk& chunk = chunks[nextChunk];
+    changed.wait(lock, [&] { return chunk.ready || finished; });
+    if (!chunk.ready) {
+        return false;
+    }
+    heldChunk = nextChunk;
+    nextChunk ^= 1;
+    packets = chunk.packets.data();
+    count = chunk.count;
+    return true;
+}
+
+size_t TraceStream::BufferBytes() const {
+    return VectorBytes(text) + VectorBytes(chunks[0].packets) + VectorBytes(chunks[1].packets);
+}
+
+void TraceStream::prefetch() {
+    for (int slot = 0;; slot ^= 1) {
+        Chunk& chunk = chunks[slot];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return !chunk.ready || stopping; });
+            if (stopping) {
+                break;
+            }
+        }
+        // The consumer does not touch a chunk that is not ready, so it is filled unlocked
+        bool ok = fill(chunk);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ok) {
+            failed = true;
+        } else if (chunk.count > 0) {
+            chunk.ready = true;
+        }
+        if (!ok || chunk.count < chunkPackets) {
+            break;
+        }
+        changed.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    changed.notify_all();
+}
+
+// Parses up to chunkPackets packets into chunk, reading more text whenever it holds no
+// complete line; the last line of the trace need not end in a newline
+bool TraceStream::fill(Chunk& chunk) {
+    chunk.count = 0;
+    while (chunk.count < chunkPackets) {
+        const char* begin = text.data() + textBegin;
+        const char* end = text.data() + textEnd;
+
+        // Take whole lines, no more than the chunk has room for
+        size_t wanted = chunkPackets - chunk.count;
+        size_t lines = 0;
+        const char* cut = begin;
+        while (lines < wanted) {
+            const char* newline = static_cast<const char*>(memchr(cut, '\n', end - cut));
+            if (!newline) break;
+            cut = newline + 1;
+            lines++;
+        }
+        if (eof && lines < wanted && cut < end) {
+            cut = end;
+            lines++;
+        }
+
+        if (cut > begin) {
+            long parsed = ParseClassBenchTrace(begin, cut, chunk.packets.data() + chunk.count, line);
+            if (parsed < 0) {
+                return false;
+            }
+            chunk.count += static_cast<size_t>(parsed);
+            line += lines;
+            textBegin = cut - text.data();
+            continue;
+        }
+        if (eof) {
+            break;
+        }
+
+        size_t pending = textEnd - textBegin;
+        if (pending == text.size()) {
+            printf("Trace line %zu: longer than %zu bytes\n", line, text.size());
+            return false;
+        }
+        memmove(text.data(), text.data() + textBegin, pending);
+        textBegin = 0;
+        textEnd = pending;
+        size_t got = fread(text.data() + textEnd, 1, text.size() - textEnd, fp);
+        textEnd += got;
+        if (got == 0) {
+            if (ferror(fp)) {
+                printf("Read error in trace at line %zu\n", line);
+                return false;
+            }
+            eof = true;
+        }
+    }
+    return true;
+}
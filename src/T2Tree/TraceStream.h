@@ -0,0 +1,64 @@
+#ifndef TRACE_STREAM_H
+#define TRACE_STREAM_H
+
+#include "../ElementaryClasses.h"
+#include <cstdio>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+// Reads a ClassBench trace in chunks of at most chunkPackets packets on a prefetch thread.
+// Two chunks alternate: while the caller works on the one Next() handed out, the other is
+// read and parsed. Memory is the two chunks plus one READ_BYTES text buffer, whatever the
+// length of the trace.
+class TraceStream {
+public:
+    static constexpr size_t READ_BYTES = 1 << 20;  // Also the longest line accepted
+
+    explicit TraceStream(size_t chunkPackets);
+    ~TraceStream();
+    TraceStream(const TraceStream&) = delete;
+    TraceStream& operator=(const TraceStream&) = delete;
+
+    // Opens the trace and starts prefetching its first chunks
+    bool Open(const char* path);
+    void Close();
+
+    // Waits for the next chunk; false once the trace is exhausted or a line failed to parse.
+    // The chunk stays valid until the following call.
+    bool Next(const PacketHeader*& packets, size_t& count);
+
+    bool Failed() const { return failed; }
+    size_t BufferBytes() const;
+
+private:
+    struct Chunk {
+        std::vector<PacketHeader> packets;
+        size_t count = 0;
+        bool ready = false;  // Parsed and not yet given back by the consumer
+    };
+
+    void prefetch();
+    bool fill(Chunk& chunk);
+
+    size_t chunkPackets;
+    FILE* fp = nullptr;
+    std::vector<char> text;
+    size_t textBegin = 0;
+    size_t textEnd = 0;
+    size_t line = 1;
+    bool eof = false;
+
+    Chunk chunks[2];
+    int nextChunk = 0;     // Next chunk the consumer takes
+    int heldChunk = -1;    // Chunk the consumer is working on
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool finished = false;  // Prefetcher has parsed its last chunk
+    bool stopping = false;
+    bool failed = false;
+    std::thread worker;
+};
+
+#endif // TRACE_STREAM_H
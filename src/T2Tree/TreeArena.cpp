@@ -0,0 +1,97 @@
+#include "TreeArena.h"
+#include <cstdlib>
+
+TreeArena::~TreeArena() {
+    for (auto it = cleanups.rbegin(); it != cleanups.rend(); ++it) {
+        it->destroy(it->object);
+    }
+    for (LargeBlock* block = largeBlocks; block;) {
+        LargeBlock* next = block->next;
+        std::free(block);
+        block = next;
+    }
+    for (unsigned char* chunk : chunks) {
+        std::free(chunk);
+    }
+}
+
+int TreeArena::SizeClass(size_t bytes) {
+    int sizeClass = 0;
+    for (size_t size = 16; size < bytes; size <<= 1) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+void* TreeArena::allocate(size_t bytes) {
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    if (bytes > MAX_SMALL_BYTES) {
+        LargeBlock* block = static_cast<LargeBlock*>(std::malloc(offsetof(LargeBlock, data) + bytes));
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        block->prev = nullptr;
+        block->next = largeBlocks;
+        block->bytes = bytes;
+        if (largeBlocks) {
+            largeBlocks->prev = block;
+        }
+        largeBlocks = block;
+        largeBytes += bytes;
+        liveBytes += bytes;
+        return block->data;
+    }
+
+    int sizeClass = SizeClass(bytes);
+    size_t size = static_cast<size_t>(16) << sizeClass;
+    liveBytes += size;
+    if (void* p = freeLists[sizeClass]) {
+        freeLists[sizeClass] = *static_cast<void**>(p);
+        return p;
+    }
+    if (static_cast<size_t>(chunkEnd - cursor) < size) {
+        // The tail of the old chunk is left unused; it is smaller than this block
+        unsigned char* chunk = static_cast<unsigned char*>(std::malloc(CHUNK_BYTES));
+        if (!chunk) {
+            throw std::bad_alloc();
+        }
+        chunks.push_back(chunk);
+        chunkBytes += CHUNK_BYTES;
+        cursor = chunk;
+        chunkEnd = chunk + CHUNK_BYTES;
+    }
+    void* p = cursor;
+    cursor += size;
+    return p;
+}
+
+void TreeArena::deallocate(void* p, size_t bytes) {
+    if (!p) {
+        return;
+    }
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    if (bytes > MAX_SMALL_BYTES) {
+        LargeBlock* block = reinterpret_cast<LargeBlock*>(static_cast<unsigned char*>(p) - offsetof(LargeBlock, data));
+        if (block->prev) {
+            block->prev->next = block->next;
+        } else {
+            largeBlocks = block->next;
+        }
+        if (block->next) {
+            block->next->prev = block->prev;
+        }
+        largeBytes -= block->bytes;
+        liveBytes -= block->bytes;
+        std::free(block);
+        return;
+    }
+
+    int sizeClass = SizeClass(bytes);
+    liveBytes -= static_cast<size_t>(16) << sizeClass;
+    *static_cast<void**>(p) = freeLists[sizeClass];
+    freeLists[sizeClass] = p;
+}
@@ -0,0 +1,109 @@
+#ifndef TREE_ARENA_H
+#define TREE_ARENA_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+// Memory of one master tree: its nodes and everything they hold. Small blocks are carved
+// from large chunks and recycled through per-size free lists, so leaves can grow and
+// shrink under updates without going back to the heap. Blocks above MAX_SMALL_BYTES (the
+// rule copies of large nodes during construction) go to the heap and back as soon as they
+// are released, so a tree keeps no memory for storage it has dropped.
+//
+// Destroying the arena frees the whole tree at once. Objects made with create() are not
+// destroyed one by one, so they must keep all their storage in the arena (see
+// ArenaAllocator); objects made with make() also have their destructor run.
+//
+// Not thread-safe: a tree is only changed by one writer at a time.
+class TreeArena {
+public:
+    static constexpr size_t CHUNK_BYTES = 64 * 1024;
+    static constexpr size_t MAX_SMALL_BYTES = 16 * 1024;
+
+    TreeArena() = default;
+    ~TreeArena();
+    TreeArena(const TreeArena&) = delete;
+    TreeArena& operator=(const TreeArena&) = delete;
+
+    void* allocate(size_t bytes);
+    void deallocate(void* p, size_t bytes);
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // As create(), for objects that own memory outside the arena
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        T* object = create<T>(std::forward<Args>(args)...);
+        cleanups.push_back({object, [](void* p) { static_cast<T*>(p)->~T(); }});
+        return object;
+    }
+
+    size_t reservedBytes() const { return chunkBytes + largeBytes; }  // Held from the heap
+    size_t usedBytes() const { return liveBytes; }                    // Handed out and not released
+
+    // Bytes an allocation of `bytes` takes from the arena, as counted in usedBytes()
+    static size_t BlockBytes(size_t bytes) {
+        if (bytes == 0) {
+            bytes = 1;
+        }
+        return bytes > MAX_SMALL_BYTES ? bytes : static_cast<size_t>(16) << SizeClass(bytes);
+    }
+
+private:
+    struct LargeBlock {
+        LargeBlock* prev;
+        LargeBlock* next;
+        size_t bytes;
+        alignas(std::max_align_t) unsigned char data[1];
+    };
+    struct Cleanup {
+        void* object;
+        void (*destroy)(void*);
+    };
+    static constexpr size_t ALIGN = alignof(std::max_align_t);
+    static constexpr int SIZE_CLASSES = 11;  // 16 bytes to MAX_SMALL_BYTES, by powers of two
+
+    static int SizeClass(size_t bytes);
+
+    std::vector<unsigned char*> chunks;
+    unsigned char* cursor = nullptr;
+    unsigned char* chunkEnd = nullptr;
+    void* freeLists[SIZE_CLASSES] = {};
+    LargeBlock* largeBlocks = nullptr;
+    std::vector<Cleanup> cleanups;
+    size_t chunkBytes = 0;
+    size_t largeBytes = 0;
+    size_t liveBytes = 0;
+};
+
+// Standard allocator drawing from a TreeArena, for containers held by arena objects
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    TreeArena* arena;
+
+    explicit ArenaAllocator(TreeArena* arena) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { arena->deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif // TREE_ARENA_H
@@ -0,0 +1,206 @@
+#include "TupleSpaceIndex.h"
+#include <algorithm>
+#include <array>
+
+static const int fieldWidth[MAXDIMENSIONS] = {32, 32, 16, 16, 8};
+
+typedef std::array<uint32_t, MAXDIMENSIONS> TupleKey;
+
+static inline uint32_t HashKey(const uint32_t* key) {
+    uint32_t h = 0;
+    for (int d = 0; d < MAXDIMENSIONS; d++) {
+        h = (h ^ key[d]) * 0x9E3779B1u;
+        h ^= h >> 15;
+    }
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
+}
+
+uint32_t TupleSpaceIndex::FieldMask(const Rule& rule, int field) {
+    if (field != FieldSA && field != FieldDA) {
+        return 0;
+    }
+    int width = fieldWidth[field];
+    int len = std::min(static_cast<int>(rule.prefix_length[field]), width) / 8 * 8;
+    if (len == 0) {
+        return 0;
+    }
+    uint32_t fieldMask = width == 32 ? ~0u : ((1u << width) - 1);
+    return (fieldMask << (width - len)) & fieldMask;
+}
+
+// ========== Search ==========
+int TupleSpaceIndex::Search(const PacketHeader& p, int currentBest) const {
+    int best = currentBest;
+    const uint32_t* tuple = words + HEADER_WORDS;
+
+    for (uint32_t t = 0; t < Tuples(); t++, tuple += TUPLE_WORDS) {
+        if (static_cast<int>(tuple[0]) <= best) {
+            break;  // Tuples are ordered by their best priority
+        }
+        uint32_t key[MAXDIMENSIONS];
+        for (int d = 0; d < MAXDIMENSIONS; d++) {
+            key[d] = p[d] & tuple[3 + d];
+        }
+
+        uint32_t slotMask = tuple[1];
+        const uint32_t* slots = words + tuple[2];
+        for (uint32_t i = HashKey(key) & slotMask;; i = (i + 1) & slotMask) {
+            uint32_t offset = slots[i];
+            if (offset == 0) {
+                break;
+            }
+            const uint32_t* entry = words + offset;
+            if (!std::equal(key, key + MAXDIMENSIONS, entry)) {
+                continue;
+            }
+            const RuleBlock* block = reinterpret_cast<const RuleBlock*>(entry + MAXDIMENSIONS);
+            int idx = block->FirstMatch(p, best);
+            if (idx >= 0) {
+                best = block->Priority()[idx];
+            }
+            break;
+        }
+    }
+    return best;
+}
+
+// ========== Build ==========
+void TupleSpaceIndex::Build(const std::vector<Rule>& rules, std::vector<uint32_t>& words, const uint32_t* tupleMask,
+                            size_t minTupleRules) {
+    struct Item {
+        TupleKey mask;
+        TupleKey key;
+        const Rule* rule;
+    };
+    std::vector<Item> items(rules.size());
+    for (size_t i = 0; i < rules.size(); i++) {
+        for (int d = 0; d < MAXDIMENSIONS; d++) {
+            items[i].mask[d] = tupleMask ? tupleMask[d] : FieldMask(rules[i], d);
+            items[i].key[d] = rules[i].range[d][LowDim] & items[i].mask[d];
+        }
+        items[i].rule = &rules[i];
+    }
+    // Tuples, then buckets, are contiguous runs; each bucket in descending priority
+    auto byTuple = [](const Item& a, const Item& b) {
+        if (a.mask != b.mask) return a.mask < b.mask;
+        if (a.key != b.key) return a.key < b.key;
+        return a.rule->priority > b.rule->priority;
+    };
+    std::stable_sort(items.begin(), items.end(), byTuple);
+
+    if (!tupleMask && minTupleRules > 1) {
+        bool merged = false;
+        for (size_t i = 0; i < items.size();) {
+            size_t j = i;
+            while (j < items.size() && items[j].mask == items[i].mask) {
+                j++;
+            }
+            if (j - i < minTupleRules) {
+                for (size_t k = i; k < j; k++) {
+                    items[k].mask = TupleKey{};
+                    items[k].key = TupleKey{};
+                }
+                merged = true;
+            }
+            i = j;
+        }
+        if (merged) {
+            std::stable_sort(items.begin(), items.end(), byTuple);
+        }
+    }
+
+    struct TupleRun {
+        size_t begin, end, buckets;
+        int maxPriority;
+    };
+    std::vector<TupleRun> order;
+    for (size_t i = 0; i < items.size();) {
+        TupleRun run{i, i, 0, -1};
+        while (run.end < items.size() && items[run.end].mask == items[i].mask) {
+            if (run.end == i || items[run.end].key != items[run.end - 1].key) {
+                run.buckets++;
+            }
+            run.maxPriority = std::max(run.maxPriority, items[run.end].rule->priority);
+            run.end++;
+        }
+        order.push_back(run);
+        i = run.end;
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [](const TupleRun& a, const TupleRun& b) { return a.maxPriority > b.maxPriority; });
+
+    words.assign(HEADER_WORDS + order.size() * TUPLE_WORDS, 0);
+    words[0] = static_cast<uint32_t>(order.size());
+    words[1] = static_cast<uint32_t>(rules.size());
+
+    std::vector<const Rule*> bucketRules;
+    for (size_t t = 0; t < order.size(); t++) {
+        const TupleRun& run = order[t];
+        size_t slotCount = 2;
+        while (slotCount < 2 * run.buckets) {
+            slotCount <<= 1;
+        }
+        size_t slotOffset = words.size();
+        words.resize(words.size() + slotCount, 0);
+
+        uint32_t* record = &words[HEADER_WORDS + t * TUPLE_WORDS];
+        record[0] = static_cast<uint32_t>(run.maxPriority);
+        record[1] = static_cast<uint32_t>(slotCount - 1);
+        record[2] = static_cast<uint32_t>(slotOffset);
+        std::copy(items[run.begin].mask.begin(), items[run.begin].mask.end(), record + 3);
+
+        for (size_t i = run.begin; i < run.end;) {
+            bucketRules.clear();
+            size_t j = i;
+            for (; j < run.end && items[j].key == items[i].key; j++) {
+                bucketRules.push_back(items[j].rule);
+            }
+
+            uint32_t stride = RuleBlock::StrideFor(bucketRules.size());
+            size_t entryOffset = words.size();
+            words.resize(entryOffset + MAXDIMENSIONS + RuleBlock::Words(stride), 0);
+            std::copy(items[i].key.begin(), items[i].key.end(), words.begin() + entryOffset);
+            RuleBlock::Write(&words[entryOffset + MAXDIMENSIONS], stride, bucketRules.data(), bucketRules.size());
+
+            uint32_t slot = HashKey(items[i].key.data()) & (slotCount - 1);
+            while (words[slotOffset + slot] != 0) {
+                slot = (slot + 1) & (slotCount - 1);
+            }
+            words[slotOffset + slot] = static_cast<uint32_t>(entryOffset);
+            i = j;
+        }
+    }
+    words[2] = static_cast<uint32_t>(words.size());
+}
+
+bool TupleSpaceIndex::Validate(const uint32_t* words, size_t count) {
+    if (count < HEADER_WORDS || words[2] != count) return false;
+    uint64_t tuples = words[0];
+    if (HEADER_WORDS + tuples * TUPLE_WORDS > count) return false;
+
+    for (uint64_t t = 0; t < tuples; t++) {
+        const uint32_t* record = words + HEADER_WORDS + t * TUPLE_WORDS;
+        uint64_t slotCount = static_cast<uint64_t>(record[1]) + 1;
+        uint64_t slotOffset = record[2];
+        if ((slotCount & (slotCount - 1)) != 0 || slotOffset + slotCount > count) return false;
+
+        bool hasEmpty = false;  // Probing ends at an empty slot
+        for (uint64_t i = 0; i < slotCount; i++) {
+            uint64_t entry = words[slotOffset + i];
+            if (entry == 0) {
+                hasEmpty = true;
+                continue;
+            }
+            if (entry + MAXDIMENSIONS + 2 > count) return false;
+            const RuleBlock* block = reinterpret_cast<const RuleBlock*>(words + entry + MAXDIMENSIONS);
+            uint64_t blockWords = 2 + static_cast<uint64_t>(RULE_BLOCK_COLUMNS) * block->stride;
+            if (block->count > block->stride || entry + MAXDIMENSIONS + blockWords > count) {
+                return false;
+            }
+        }
+        if (!hasEmpty) return false;
+    }
+    return true;
+}
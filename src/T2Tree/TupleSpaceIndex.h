@@ -0,0 +1,55 @@
+#ifndef TUPLE_SPACE_INDEX_H
+#define TUPLE_SPACE_INDEX_H
+
+#include "PackedRuleBlock.h"
+#include <vector>
+#include <cstdint>
+
+// Tuple-space index over a rule set, stored as one pointer-free word array so it can be
+// shared with lookups as is or mapped from a snapshot.
+//
+// Rules are grouped by the tuple of their source and destination prefix lengths, rounded
+// down to whole bytes, so a packet can only match rules in the bucket of its own masked
+// key. Ports and protocol are left to the bucket scan: port ranges are rarely prefixes and
+// hashing them multiplies the tuple count. Each tuple is an open-addressing hash table from
+// masked key to a RuleBlock sorted by priority; the block check still compares full ranges.
+// Tuples are kept in descending order of their best priority, so a search stops at the
+// first tuple that cannot beat the current best.
+//
+// Layout:
+//   [0] tuple count  [1] rule count  [2] total words (including any slack a copy is padded with)
+//   tuple records, TUPLE_WORDS each: maxPriority, slotMask, slotOffset, mask[MAXDIMENSIONS]
+//   per tuple: slotMask + 1 slots holding an entry offset, 0 for an empty slot
+//   entries: masked key[MAXDIMENSIONS] followed by a RuleBlock
+struct TupleSpaceIndex {
+    static constexpr int HEADER_WORDS = 3;
+    static constexpr int TUPLE_WORDS = 3 + MAXDIMENSIONS;
+
+    const uint32_t* words;
+
+    uint32_t Tuples() const { return words[0]; }
+    uint32_t Rules() const { return words[1]; }
+    uint32_t Words() const { return words[2]; }
+    int MaxPriority() const {
+        return Tuples() ? static_cast<int>(words[HEADER_WORDS]) : -1;
+    }
+
+    // Highest priority above currentBest among matching rules, currentBest if none
+    int Search(const PacketHeader& p, int currentBest) const;
+
+    // Tuple mask of a rule's field: the fixed leading address bits rounded down to whole
+    // bytes, 0 for ports and protocol
+    static uint32_t FieldMask(const Rule& rule, int field);
+
+    // Serialize rules into words (replacing its contents). Rules are split by FieldMask, or
+    // all put in the single tuple tupleMask when given; it must only cover bits every rule
+    // fixes. Natural tuples with fewer than minTupleRules rules share one all-wildcard tuple,
+    // scanned as a single block, since hashing a handful of rules costs more than it saves
+    static void Build(const std::vector<Rule>& rules, std::vector<uint32_t>& words,
+                      const uint32_t* tupleMask = nullptr, size_t minTupleRules = 1);
+
+    // Check that a word array of `count` words is a well-formed index (for mapped input)
+    static bool Validate(const uint32_t* words, size_t count);
+};
+
+#endif // TUPLE_SPACE_INDEX_H
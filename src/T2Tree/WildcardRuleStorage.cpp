@@ -1,8 +1,14 @@
 #include "WildcardRuleStorage.h"
+#include "MemoryAccounting.h"
 #include <iostream>
 
-WildcardRuleStorage::WildcardRuleStorage(int capacity) : capacity(capacity), sorted(true) {
+WildcardRuleStorage::WildcardRuleStorage(int capacity) : capacity(capacity) {
     rules.reserve(capacity);
+    rebuildIndex();
+}
+
+void WildcardRuleStorage::rebuildIndex() {
+    TupleSpaceIndex::Build(rules, index, nullptr, WRS_MIN_TUPLE_RULES);
 }
 
 bool WildcardRuleStorage::addRule(const Rule& rule) {
@@ -10,44 +16,64 @@ bool WildcardRuleStorage::addRule(const Rule& rule) {
         return false;
     }
     
-    rules.push_back(rule);
-    sorted = false;
+    // Sorted insert keeps the lookup path free of lazy sorting
+    auto pos = std::upper_bound(rules.begin(), rules.end(), rule,
+        [](const Rule& a, const Rule& b) { return a.priority > b.priority; });
+    rules.insert(pos, rule);
+    rebuildIndex();
     return true;
 }
 
+size_t WildcardRuleStorage::addRules(const std::vector<Rule>& candidates) {
+    size_t added = 0;
+    for (const Rule& rule : candidates) {
+        if (static_cast<int>(rules.size()) >= capacity) {
+            break;
+        }
+        auto pos = std::upper_bound(rules.begin(), rules.end(), rule,
+            [](const Rule& a, const Rule& b) { return a.priority > b.priority; });
+        rules.insert(pos, rule);
+        added++;
+    }
+    if (added > 0) {
+        rebuildIndex();
+    }
+    return added;
+}
+
 bool WildcardRuleStorage::removeRule(const Rule& rule) {
     auto it = std::find_if(rules.begin(), rules.end(), 
         [&rule](const Rule& r) { return r.id == rule.id; });
     
     if (it != rules.end()) {
         rules.erase(it);
-        sorted = false;
+        rebuildIndex();
         return true;
     }
     
     return false;
 }
 
-int WildcardRuleStorage::searchHighestPriority(const Packet& packet) {
+size_t WildcardRuleStorage::removeRules(const std::unordered_set<int>& ids) {
+    auto end = std::remove_if(rules.begin(), rules.end(),
+        [&ids](const Rule& r) { return ids.count(r.id) != 0; });
+    size_t removed = static_cast<size_t>(rules.end() - end);
+    if (removed > 0) {
+        rules.erase(end, rules.end());
+        rebuildIndex();
+    }
+    return removed;
+}
+
+int WildcardRuleStorage::searchHighestPriority(const PacketHeader& packet) const {
     if (rules.empty()) {
         return -1;
     }
     
-    ensureSorted();
-    
-    int highestPriority = -1;
-    
-    // Since rules are sorted by priority, return the first match
-    for (const Rule& rule : rules) {
-        if (rule.MatchesPacket(packet)) {
-            return rule.priority;  // Directly return the first match (highest priority)
-        }
-    }
-    
-    return highestPriority;
+    return TupleSpaceIndex{index.data()}.Search(packet, -1);
 }
 
-std::vector<Rule> WildcardRuleStorage::searchAllMatches(const Packet& packet) {
+std::vector<Rule> WildcardRuleStorage::searchAllMatches(const PacketHeader& packet) const {
     std::vector<Rule> matches;
     
     for (const Rule& rule : rules) {
@@ -64,31 +90,20 @@ std::vector<Rule> WildcardRuleStorage::searchAllMatches(const Packet& packet) {
     return matches;
 }
 
-void WildcardRuleStorage::ensureSorted() {
-    if (!sorted) {
-        sortRules();
-        sorted = true;
-    }
-}
-
-void WildcardRuleStorage::sortRules() {
-    std::sort(rules.begin(), rules.end(), 
-        [](const Rule& a, const Rule& b) {
-            return a.priority > b.priority;
-        });
-}
-
 void WildcardRuleStorage::clear() {
     rules.clear();
-    sorted = true;
+    rebuildIndex();
 }
 
 std::vector<Rule> WildcardRuleStorage::getRulesCopy() const {
     return rules;
 }
 
+size_t WildcardRuleStorage::memoryUsage() const {
+    return VectorBytes(rules) + VectorBytes(index);
+}
+
 const std::vector<Rule>& WildcardRuleStorage::getRules() const {
-    const_cast<WildcardRuleStorage*>(this)->ensureSorted();
     return rules;
 }
 
@@ -97,7 +112,7 @@ bool WildcardRuleStorage::validateState() const {
         return false;
     }
     
-    if (sorted && rules.size() > 1) {
+    if (rules.size() > 1) {
         for (size_t i = 1; i < rules.size(); i++) {
             if (rules[i-1].priority < rules[i].priority) {
                 return false;
@@ -2,10 +2,16 @@
 #define WILDCARD_RULE_STORAGE_H
 
 #include "../ElementaryClasses.h"
+#include "TupleSpaceIndex.h"
 #include <vector>
 #include <algorithm>
 #include <set>
+#include <unordered_set>
 
+// Wildcard rules parked at an internal node. The lookup copy is a tuple-space index, so a
+// node can hold far more rules than a linear scan would allow: a packet only checks the
+// bucket of its own key in each tuple, and tuples that cannot beat the best match so far
+// are skipped. Small storages collapse into a single block (see WRS_MIN_TUPLE_RULES).
 class WildcardRuleStorage {
 public:
     explicit WildcardRuleStorage(int capacity = 10);
@@ -13,15 +19,21 @@ public:
 
     // Add rule to WRS
     bool addRule(const Rule& rule);
+
+    // Add rules up to the capacity with one index rebuild, return how many were added
+    size_t addRules(const std::vector<Rule>& candidates);
     
     // Remove rule
     bool removeRule(const Rule& rule);
     
-    // Search for matching rules, return highest priority
-    int searchHighestPriority(const Packet& packet);
+    // Remove every rule whose id is in ids with one index rebuild, return how many were removed
+    size_t removeRules(const std::unordered_set<int>& ids);
+    
+    // Search for matching rules, return highest priority (read-only, safe to call concurrently)
+    int searchHighestPriority(const PacketHeader& packet) const;
     
     // Search for all matching rules
-    std::vector<Rule> searchAllMatches(const Packet& packet);
+    std::vector<Rule> searchAllMatches(const PacketHeader& packet) const;
     
     // Get rule count
     size_t size() const { return rules.size(); }
@@ -32,27 +44,34 @@ public:
     // Get capacity
     int getCapacity() const { return capacity; }
     
-    // Ensure rules are sorted by priority
-    void ensureSorted();
-    
     // Clear WRS
     void clear();
     
-    // Get rule reference (ensure sorted)
+    // Get rule reference, sorted by descending priority
     const std::vector<Rule>& getRules() const;
     
     // Get rule copy (for statistics)
     std::vector<Rule> getRulesCopy() const;
     
+    // Lookup copy in TupleSpaceIndex layout, embedded as is into compiled images
+    const std::vector<uint32_t>& getIndexWords() const { return index; }
+
+    // Heap bytes held by the rules and the index (the object itself not included)
+    size_t memoryUsage() const;
+
     // Validate WRS internal state
     bool validateState() const;
 
 private:
-    std::vector<Rule> rules;
+    // Natural tuples smaller than this are merged into the scanned all-wildcard tuple: below
+    // it the vectorized block scan beats a hash probe per tuple
+    static constexpr size_t WRS_MIN_TUPLE_RULES = 32;
+
+    std::vector<Rule> rules;      // Kept sorted by descending priority on every change
+    std::vector<uint32_t> index;  // TupleSpaceIndex words over rules
     int capacity;
-    bool sorted;
-    
-    void sortRules();
+
+    void rebuildIndex();
 };
 
 #endif // WILDCARD_RULE_STORAGE_H
\ No newline at end of file
@@ -11,8 +11,16 @@
 #include <queue>
 #include <climits>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#ifdef __linux__
+#include <pthread.h>
+#endif
 #include "./T2Tree/T2Tree.h"
 #include "./T2Tree/Tools.h"
+#include "./T2Tree/ClassBenchParser.h"
+#include "./T2Tree/TraceStream.h"
+#include "./T2Tree/LatencyHistogram.h"
 
 using namespace std;
 
@@ -20,8 +28,8 @@ using namespace std;
 // bool DEBUG_MODE = false;
 // bool VERIFY_CLASSIFICATION = false;
 
-FILE *fpr = fopen("./acl_10k", "r");
-FILE *fpt = fopen("./acl_10k_trace", "r");
+const char *ruleFile = "./acl_10k";
+const char *traceFile = "./acl_10k_trace";
 string ruleName;
 
 int binth = 8;       
@@ -29,6 +37,12 @@ int maxTree = 32;
 int maxBits = 4;     
 int maxLevel = 6;    
 int wrsThreshold = -1;
+int numThreads = 0;  // Worker-pool benchmark threads, 0 = one per hardware thread
+const char *saveSnapshotFile = nullptr;  // Write the built classifier here
+const char *loadSnapshotFile = nullptr;  // Map this snapshot instead of building
+int buildThreadsMax = 0;  // Report construction time for 1..buildThreadsMax threads, 0 = off
+int rebuildInterval = 0;  // Background rebuild period (ms) during the concurrent update test, 0 = off
+int streamChunk = 0;  // Replay the trace from disk in chunks of this many packets, 0 = load it whole
 
 int rand_update[MAXRULES];
 
@@ -88,164 +102,275 @@ int getRecommendedWRSThreshold(int ruleCount, int binth) {
 //     printf("==================\n");
 // }
 
-vector<Rule> loadrule(FILE *fp) {
-    unsigned int tmp;
-    unsigned sip1, sip2, sip3, sip4, smask;
-    unsigned dip1, dip2, dip3, dip4, dmask;
-    unsigned sport1, sport2;
-    unsigned dport1, dport2;
-    unsigned protocal, protocol_mask;
-    unsigned ht, htmask;
-    int number_rule = 0;
+// Shard the trace over numWorkers threads that share one classifier. Each worker classifies
+// its slice trials times with its own LookupStats, pinned to one core where supported.
+void runWorkerPool(const T2Tree &T2, const vector<PacketHeader> &packets, int trials, int numWorkers,
+                   uint32_t number_rule) {
+    // One cache line per worker, so no worker's counters share a line with its neighbour's
+    struct alignas(64) Worker {
+        size_t begin = 0;
+        size_t end = 0;
+        double seconds = 0;
+        int miss = 0;
+        LookupStats stats;
+    };
+    vector<Worker> workers(numWorkers);
+    for (int w = 0; w < numWorkers; w++) {
+        workers[w].begin = packets.size() * w / numWorkers;
+        workers[w].end = packets.size() * (w + 1) / numWorkers;
+    }
 
-    std::vector<Rule> rule;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    vector<std::thread> threads;
+    for (int w = 0; w < numWorkers; w++) {
+        threads.emplace_back([&, w]() {
+            Worker &worker = workers[w];
+#ifdef __linux__
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(w % cores, &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+            size_t count = worker.end - worker.begin;
+            vector<int> result(count, -1);
+            ready++;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
 
-    while (true) {
-        Rule r;
-        std::array<Point, 2> points{};
-        if (fscanf(fp, "@%d.%d.%d.%d/%d\t%d.%d.%d.%d/%d\t%d : %d\t%d : %d\t%x/%x\t%x/%x\n",
-                   &sip1, &sip2, &sip3, &sip4, &smask, &dip1, &dip2, &dip3, &dip4, &dmask, &sport1, &sport2,
-                   &dport1, &dport2, &protocal, &protocol_mask, &ht, &htmask) != 18)
-            break;
+            auto t0 = std::chrono::steady_clock::now();
+            for (int i = 0; i < trials; i++) {
+                T2.ClassifyBatch(packets.data() + worker.begin, count, result.data(), worker.stats);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+            worker.seconds = elapsed.count();
 
-        r.prefix_length[0] = smask;
-        r.prefix_length[1] = dmask;
-
-        if (smask == 0) {
-            points[0] = 0;
-            points[1] = 0xFFFFFFFF;
-        } else if (smask > 0 && smask <= 8) {
-            tmp = sip1 << 24;
-            points[0] = tmp;
-            points[1] = points[0] + (1 << (32 - smask)) - 1;
-        } else if (smask > 8 && smask <= 16) {
-            tmp = sip1 << 24;
-            tmp += sip2 << 16;
-            points[0] = tmp;
-            points[1] = points[0] + (1 << (32 - smask)) - 1;
-        } else if (smask > 16 && smask <= 24) {
-            tmp = sip1 << 24;
-            tmp += sip2 << 16;
-            tmp += sip3 << 8;
-            points[0] = tmp;
-            points[1] = points[0] + (1 << (32 - smask)) - 1;
-        } else if (smask > 24 && smask <= 32) {
-            tmp = sip1 << 24;
-            tmp += sip2 << 16;
-            tmp += sip3 << 8;
-            tmp += sip4;
-            points[0] = tmp;
-            points[1] = points[0] + (1 << (32 - smask)) - 1;
-        } else {
-            printf("Src IP length exceeds 32\n");
-            exit(-1);
-        }
-        r.range[0] = points;
-
-        if (dmask == 0) {
-            points[0] = 0;
-            points[1] = 0xFFFFFFFF;
-        } else if (dmask > 0 && dmask <= 8) {
-            tmp = dip1 << 24;
-            points[0] = tmp;
-            points[1] = points[0] + (1 << (32 - dmask)) - 1;
-        } else if (dmask > 8 && dmask <= 16) {
-            tmp = dip1 << 24;
-            tmp += dip2 << 16;
-            points[0] = tmp;
-            points[1] = points[0] + (1 << (32 - dmask)) - 1;
-        } else if (dmask > 16 && dmask <= 24) {
-            tmp = dip1 << 24;
-            tmp += dip2 << 16;
-            tmp += dip3 << 8;
-            points[0] = tmp;
-            points[1] = points[0] + (1 << (32 - dmask)) - 1;
-        } else if (dmask > 24 && dmask <= 32) {
-            tmp = dip1 << 24;
-            tmp += dip2 << 16;
-            tmp += dip3 << 8;
-            tmp += dip4;
-            points[0] = tmp;
-            points[1] = points[0] + (1 << (32 - dmask)) - 1;
-        } else {
-            printf("Dest IP length exceeds 32\n");
-            exit(-1);
-        }
-        r.range[1] = points;
+            for (size_t j = 0; j < count; j++) {
+                int id = static_cast<int>(number_rule) - 1 - result[j];
+                if (id == -1 || static_cast<unsigned int>(id) > packets[worker.begin + j].flowId) {
+                    worker.miss += trials;
+                }
+            }
+        });
+    }
 
-        points[0] = sport1;
-        points[1] = sport2;
-        r.range[2] = points;
+    while (ready.load() < numWorkers) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto &t : threads) {
+        t.join();
+    }
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+    LookupStats total;
+    int miss = 0;
+    printf("\tWorker pool: %d threads on %u hardware threads\n", numWorkers, cores);
+    for (int w = 0; w < numWorkers; w++) {
+        const Worker &worker = workers[w];
+        double pkts = static_cast<double>(worker.end - worker.begin) * trials;
+        printf("\t  Core %d: %.6f Mpps (%.0f packets)\n", w,
+               worker.seconds > 0 ? pkts / worker.seconds / 1e6 : 0.0, pkts);
+        total.Merge(worker.stats);
+        miss += worker.miss;
+    }
+    printf("\tWorker pool classification: %d of %lu packets misclassified\n", miss,
+           static_cast<unsigned long>(total.packets));
+    printf("\tWorker pool aggregate throughput: %.6f Mpps\n", total.packets / wall.count() / 1e6);
+    if (total.packets > 0) {
+        printf("\tAverage memory accesses per packet: %.2f (worst %lu)\n",
+               static_cast<double>(total.queryCount) / total.packets, static_cast<unsigned long>(total.worstQuery));
+    }
+}
 
-        points[0] = dport1;
-        points[1] = dport2;
-        r.range[3] = points;
+// Time every lookup of the trace on its own, trials times, and report the latency
+// percentiles overall and for each number of memory accesses a lookup took
+void runLatencyProfile(const T2Tree &T2, const vector<PacketHeader> &packets, int trials) {
+    // The cost of reading the clock twice is taken off every sample
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t t0 = LatencyClock::Now();
+        overhead = std::min(overhead, LatencyClock::Now() - t0);
+    }
 
-        for (int i = 15; i >= 0; i--) {
-            unsigned int Bit = 1 << i;
-            unsigned sp = sport1 ^ sport2;
-            if (sp & Bit) {
-                break;
+    LatencyHistogram latency;
+    vector<LatencyHistogram> byAccesses;
+    LookupStats stats;
+    for (int i = 0; i < trials; i++) {
+        for (const PacketHeader &packet : packets) {
+            uint64_t accesses = stats.queryCount;
+            uint64_t t0 = LatencyClock::Now();
+            T2.Classify(packet, stats);
+            uint64_t ticks = LatencyClock::Now() - t0;
+            ticks = ticks > overhead ? ticks - overhead : 0;
+            accesses = stats.queryCount - accesses;
+            if (accesses >= byAccesses.size()) {
+                byAccesses.resize(accesses + 1);
             }
-            r.prefix_length[2]++;
+            latency.Record(ticks);
+            byAccesses[accesses].Record(ticks);
         }
+    }
+    if (stats.packets == 0) {
+        return;
+    }
 
-        for (int i = 15; i >= 0; i--) {
-            unsigned int Bit = 1 << i;
-            unsigned dp = dport1 ^ dport2;
-            if (dp & Bit) {
-                break;
-            }
-            r.prefix_length[3]++;
+    double ticksPerUs = LatencyClock::TicksPerNanosecond() * 1e3;
+    printf("\tLookup latency: p50 %.3f us, p99 %.3f us, p99.9 %.3f us, max %.3f us (mean %.3f us)\n",
+           latency.Percentile(0.5) / ticksPerUs, latency.Percentile(0.99) / ticksPerUs,
+           latency.Percentile(0.999) / ticksPerUs, latency.Max() / ticksPerUs, latency.Mean() / ticksPerUs);
+    printf("\tMemory accesses per lookup:\n");
+    for (size_t q = 0; q < stats.histogram.size(); q++) {
+        if (stats.histogram[q] == 0) {
+            continue;
         }
+        const LatencyHistogram &group = byAccesses[q];
+        printf("\t  %2zu: %6.2f%% of lookups, p50 %.3f us, p99 %.3f us, max %.3f us\n", q,
+               100.0 * stats.histogram[q] / stats.packets, group.Percentile(0.5) / ticksPerUs,
+               group.Percentile(0.99) / ticksPerUs, group.Max() / ticksPerUs);
+    }
+}
 
-        if (protocol_mask == 0xFF) {
-            points[0] = protocal;
-            points[1] = protocal;
-        } else if (protocol_mask == 0) {
-            points[0] = 0;
-            points[1] = 0xFF;
-        } else {
-            printf("Protocol mask error\n");
-            exit(-1);
+// Classify the trace chunk by chunk as a TraceStream reads it, so memory stays the same for
+// any trace length. Sustained throughput includes the time spent waiting for the reader.
+void runStreamingReplay(const T2Tree &T2, const char *path, uint32_t number_rule) {
+    TraceStream stream(static_cast<size_t>(streamChunk));
+    if (!stream.Open(path)) {
+        exit(-1);
+    }
+    vector<int> result(streamChunk, -1);
+    LookupStats stats;
+    size_t chunks = 0;
+    unsigned long miss = 0;
+    std::chrono::duration<double> classifying(0), waiting(0);
+    double minChunkMs = 0, maxChunkMs = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    const PacketHeader *chunk;
+    size_t count;
+    while (true) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (!stream.Next(chunk, count)) {
+            break;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        T2.ClassifyBatch(chunk, count, result.data(), stats);
+        auto t2 = std::chrono::steady_clock::now();
+        waiting += t1 - t0;
+        classifying += t2 - t1;
+
+        double chunkMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        minChunkMs = chunks == 0 ? chunkMs : std::min(minChunkMs, chunkMs);
+        maxChunkMs = std::max(maxChunkMs, chunkMs);
+        chunks++;
+
+        for (size_t j = 0; j < count; j++) {
+            int id = static_cast<int>(number_rule) - 1 - result[j];
+            if (id == -1 || static_cast<unsigned int>(id) > chunk[j].flowId) {
+                miss++;
+            }
         }
-        r.range[4] = points;
-        r.prefix_length[4] = protocol_mask;
-        r.id = number_rule;
-
-        rule.push_back(r);
-        number_rule++;
+    }
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+    if (stream.Failed()) {
+        printf("\tStreaming replay stopped at a malformed trace line\n");
     }
 
-    int max_pri = number_rule - 1;
-    for (int i = 0; i < number_rule; i++) {
-        rule[i].priority = max_pri - i;
+    unsigned long packets = static_cast<unsigned long>(stats.packets);
+    printf("\tStreaming replay: %zu chunks of up to %d packets, %.1f MB buffered\n", chunks, streamChunk,
+           stream.BufferBytes() / (1024.0 * 1024.0));
+    printf("\t%lu packets are classified, %lu of them are misclassified\n", packets, miss);
+    if (packets == 0) {
+        return;
     }
-    return rule;
+    printf("\tSustained throughput: %.6f Mpps (classification alone: %.6f Mpps)\n",
+           packets / wall.count() / 1e6, packets / classifying.count() / 1e6);
+    printf("\tChunk latency: min %.3f ms, mean %.3f ms, max %.3f ms\n", minChunkMs,
+           classifying.count() * 1e3 / chunks, maxChunkMs);
+    printf("\tWaiting for the reader: %.3f ms (%.1f%% of the replay)\n", waiting.count() * 1e3,
+           waiting.count() * 100 / wall.count());
 }
 
-std::vector<Packet> loadpacket(FILE *fp) {
-    unsigned int header[MAXDIMENSIONS];
-    unsigned int proto_mask, fid;
-    int number_pkt = 0;
-    std::vector<Packet> packets;
-    while (true) {
-        if (fscanf(fp, "%u %u %d %d %d %u %d\n", &header[0], &header[1], &header[2], &header[3], &header[4],
-                   &proto_mask, &fid) == Null)
-            break;
-        Packet p;
-        p.push_back(header[0]);
-        p.push_back(header[1]);
-        p.push_back(header[2]);
-        p.push_back(header[3]);
-        p.push_back(header[4]);
-        p.push_back(fid);
-
-        packets.push_back(p);
-        number_pkt++;
+// Apply updates on this thread while up to numReaders threads keep classifying the trace through
+// the same instance, with copy-on-write updates enabled
+void runConcurrentUpdates(T2Tree &T2, const vector<PacketHeader> &packets, const vector<Rule> &updateRules,
+                          const vector<int> &operations, int numReaders) {
+    const size_t chunk = 256;
+    // One core is left to the updater, so the update timings do not include waiting for a core
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    int requestedReaders = numReaders;
+    numReaders = std::max(1, std::min(numReaders, static_cast<int>(cores) - 1));
+
+    T2.EnableConcurrentUpdates(true);
+    size_t rebuildsBefore = T2.RebuildCount();
+    if (rebuildInterval > 0) {
+        T2.StartBackgroundRebuild(std::chrono::milliseconds(rebuildInterval));
     }
 
-    return packets;
+    std::atomic<bool> stop(false);
+    std::atomic<int> ready(0);
+    vector<LookupStats> stats(numReaders);
+    vector<std::thread> readers;
+    for (int r = 0; r < numReaders; r++) {
+        readers.emplace_back([&, r]() {
+            vector<int> result(chunk, -1);
+            LookupStats local;  // Kept off the shared vector while timed, so readers never share a line
+            size_t pos = packets.size() * r / numReaders;
+            ready++;
+            while (!stop.load(std::memory_order_relaxed) && !packets.empty()) {
+                size_t count = std::min(chunk, packets.size() - pos);
+                T2.ClassifyBatch(packets.data() + pos, count, result.data(), local);
+                pos += count;
+                if (pos >= packets.size()) {
+                    pos = 0;
+                }
+            }
+            stats[r] = std::move(local);
+        });
+    }
+    while (ready.load() < numReaders) {
+        std::this_thread::yield();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < updateRules.size() && i < operations.size(); i++) {
+        if (operations[i] == 0) {
+            T2.InsertRule(updateRules[i]);
+        } else {
+            T2.DeleteRule(updateRules[i]);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stop.store(true);
+    for (auto &t : readers) {
+        t.join();
+    }
+    T2.StopBackgroundRebuild();
+    T2.EnableConcurrentUpdates(false);
+
+    LookupStats total;
+    for (const auto &s : stats) {
+        total.Merge(s);
+    }
+    printf("\t%zu updates with %d concurrent readers\n", updateRules.size(), numReaders);
+    if (numReaders < requestedReaders) {
+        printf("\tReaders capped from %d to leave a core to the updater\n", requestedReaders);
+    }
+    if (numReaders + 1 + (rebuildInterval > 0 ? 1 : 0) > static_cast<int>(cores)) {
+        printf("\tNote: %u hardware threads are oversubscribed, update timings include waiting for a core\n",
+               cores);
+    }
+    printf("\tAverage update time: %.6f us\n", elapsed.count() * 1e6 / updateRules.size());
+    printf("\tUpdate rate: %.0f updates/s\n", updateRules.size() / elapsed.count());
+    printf("\tReader throughput during updates: %.6f Mpps\n", total.packets / elapsed.count() / 1e6);
+    printf("\tRetired versions awaiting reclamation: %zu\n", EpochReclaimer::Pending());
+    if (rebuildInterval > 0) {
+        printf("\tBackground rebuilds: %zu, overflow rules after: %zu\n", T2.RebuildCount() - rebuildsBefore,
+               T2.GetOverflowRuleCount());
+    }
 }
 
 int main(int argc, char *argv[]) {
@@ -253,7 +378,7 @@ int main(int argc, char *argv[]) {
         if (strcmp(argv[idx], "-r") == 0) {
             const char *ruleFileName = argv[++idx];
             ruleName = ruleFileName;
-            fpr = fopen(ruleFileName, "r");
+            ruleFile = ruleFileName;
         } else if (strcmp(argv[idx], "-b") == 0) {
             binth = atoi(argv[++idx]);
         } else if (strcmp(argv[idx], "-bit") == 0) {
@@ -263,16 +388,32 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[idx], "-l") == 0) {
             maxLevel = atoi(argv[++idx]);
         } else if (strcmp(argv[idx], "-p") == 0) {
-            const char *packetFileName = argv[++idx];
-            fpt = fopen(packetFileName, "r");
+            traceFile = argv[++idx];
         } else if (strcmp(argv[idx], "-wrs") == 0) {
             wrsThreshold = atoi(argv[++idx]);
+        } else if (strcmp(argv[idx], "-threads") == 0) {
+            numThreads = atoi(argv[++idx]);
+        } else if (strcmp(argv[idx], "-buildthreads") == 0) {
+            buildThreadsMax = atoi(argv[++idx]);
+        } else if (strcmp(argv[idx], "-rebuild") == 0) {
+            rebuildInterval = atoi(argv[++idx]);
+        } else if (strcmp(argv[idx], "-stream") == 0) {
+            streamChunk = atoi(argv[++idx]);
+        } else if (strcmp(argv[idx], "-save") == 0) {
+            saveSnapshotFile = argv[++idx];
+        } else if (strcmp(argv[idx], "-load") == 0) {
+            loadSnapshotFile = argv[++idx];
+        } else if (strcmp(argv[idx], "-simd") == 0) {
+            const char *kernelName = argv[++idx];
+            if (!SelectMatchKernel(kernelName)) {
+                printf("Matching kernel '%s' is not available on this CPU, using %s\n", kernelName, ActiveMatchKernel());
+            }
         // } else if (strcmp(argv[idx], "-debug") == 0) {  // 
 //     DEBUG_MODE = true;
 //     VERIFY_CLASSIFICATION = true;
         } else if (strcmp(argv[idx], "-h") == 0) {
             cout << "T2Tree" << endl;
-            cout << "Usage: ./T2Tree_Project [-r ruleFile][-p traceFile][-b binth][-bit maxbit][-t maxTreenum][-l maxTreeDepth][-tss tssThreshold][-debug]" << endl;
+            cout << "Usage: ./T2Tree_Project [-r ruleFile][-p traceFile][-b binth][-bit maxbit][-t maxTreenum][-l maxTreeDepth][-tss tssThreshold][-debug][-simd kernel][-threads n][-buildthreads n][-rebuild ms][-stream n][-save file][-load file]" << endl;
             cout << "" << endl;
             cout << "Options:" << endl;
             cout << "  -r: rule set file path" << endl;
@@ -280,6 +421,13 @@ int main(int argc, char *argv[]) {
             cout << "  -b: leaf node capacity (default: 8)" << endl;
             cout << "  -bit: max bits per level (default: 4)" << endl;
             cout << "  -wrs: WRS threshold (default: auto)" << endl;
+            cout << "  -simd: matching kernel auto|avx512|avx2|scalar (default: auto)" << endl;
+            cout << "  -threads: worker-pool benchmark threads (default: one per hardware thread)" << endl;
+            cout << "  -buildthreads: report construction time for 1..n build threads" << endl;
+            cout << "  -rebuild: rebuild degraded trees in the background every ms during the concurrent update test" << endl;
+            cout << "  -stream: replay the trace from disk in chunks of n packets instead of loading it" << endl;
+            cout << "  -save: write a snapshot of the built classifier" << endl;
+            cout << "  -load: map a snapshot instead of building (lookup-only, skips updates)" << endl;
             cout << "  -t: max number of trees (default: 32)" << endl;
             cout << "  -l: max tree depth (default: 10)" << endl;
             // cout << "  -debug: enable debug mode with verification" << endl;  
@@ -289,15 +437,14 @@ int main(int argc, char *argv[]) {
     }
 
     vector<Rule> rule;
-    vector<Packet> packets;
+    vector<PacketHeader> packets;
     uint32_t number_rule = 0;
 
     std::chrono::time_point<std::chrono::steady_clock> start, end;
     std::chrono::duration<double> elapsed_seconds{};
     std::chrono::duration<double, std::milli> elapsed_milliseconds{};
 
-    if (fpr != nullptr) {
-        rule = loadrule(fpr);
+    if (LoadClassBenchRules(ruleFile, rule)) {
         number_rule = static_cast<uint32_t>(rule.size());
         
         if (wrsThreshold == -1) {
@@ -308,16 +455,36 @@ int main(int argc, char *argv[]) {
         printf("=== T2Tree Construction ===\n");
         printf("Parameters: maxBits=%d, maxLevel=%d, binth=%d, maxTree=%d, wrsThreshold=%d\n", 
                maxBits, maxLevel, binth, maxTree, wrsThreshold);
-        printf("Rules loaded: %u\n\n", number_rule);
+        printf("Rules loaded: %u\n", number_rule);
+        printf("Matching kernel: %s\n\n", ActiveMatchKernel());
         
-        printf("Construct T2Tree\n");
-        start = std::chrono::steady_clock::now();
         T2Tree T2(maxBits, maxLevel, binth, maxTree, wrsThreshold);
-        T2.ConstructClassifier(rule);
-        end = std::chrono::steady_clock::now();
-        elapsed_milliseconds = end - start;
-        printf("\tConstruction time: %.3f ms\n", elapsed_milliseconds.count());
-        printf("\tTotal Memory Size: %d(KB)\n", T2.MemSizeBytes() / 1024);
+        if (loadSnapshotFile) {
+            printf("Load T2Tree snapshot\n");
+            start = std::chrono::steady_clock::now();
+            if (!T2.LoadSnapshot(loadSnapshotFile)) {
+                exit(-1);
+            }
+            end = std::chrono::steady_clock::now();
+            elapsed_milliseconds = end - start;
+            printf("\tLoad time: %.3f ms\n", elapsed_milliseconds.count());
+        } else {
+            printf("Construct T2Tree\n");
+            start = std::chrono::steady_clock::now();
+            T2.ConstructClassifier(rule);
+            end = std::chrono::steady_clock::now();
+            elapsed_milliseconds = end - start;
+            printf("\tConstruction time: %.3f ms\n", elapsed_milliseconds.count());
+        }
+        if (saveSnapshotFile) {
+            start = std::chrono::steady_clock::now();
+            if (T2.SaveSnapshot(saveSnapshotFile)) {
+                end = std::chrono::steady_clock::now();
+                elapsed_milliseconds = end - start;
+                printf("\tSnapshot saved to %s in %.3f ms\n", saveSnapshotFile, elapsed_milliseconds.count());
+            }
+        }
+        T2.GetMemoryReport().Print();
         printf("\tNumber of Trees: %zu\n", T2.NumTables());
         printf("\tAverage leaf depth: %.2f\n", T2.AverageLeafDepth());
         printf("\tAverage node balance: %.3f (1 = perfect)\n", T2.AverageNodeBalance());
@@ -325,9 +492,42 @@ int main(int argc, char *argv[]) {
         printf("\tOverflow Container Rules: %zu\n", T2.GetOverflowRuleCount());
         printf("\n");
 
+        //---Parallel Construction---
+        if (buildThreadsMax > 0 && !T2.IsSnapshot()) {
+            printf("Parallel construction\n");
+            uint64_t reference = T2.Fingerprint();
+            double serialMs = 0;
+            for (int threads = 1; threads <= buildThreadsMax; threads++) {
+                T2Tree parallel(maxBits, maxLevel, binth, maxTree, wrsThreshold);
+                parallel.SetBuildThreads(threads);
+                start = std::chrono::steady_clock::now();
+                parallel.ConstructClassifier(rule);
+                end = std::chrono::steady_clock::now();
+                elapsed_milliseconds = end - start;
+                if (threads == 1) {
+                    serialMs = elapsed_milliseconds.count();
+                }
+                printf("\t%2d threads: %.3f ms (%.2fx), %s\n", threads, elapsed_milliseconds.count(),
+                       serialMs / elapsed_milliseconds.count(),
+                       parallel.Fingerprint() == reference ? "identical" : "DIFFERENT structure");
+            }
+            printf("\n");
+        }
+
         //---T2Tree---Classification---
         printf("Classify T2Tree\n");
-        packets = loadpacket(fpt);
+        if (streamChunk > 0) {
+            runStreamingReplay(T2, traceFile, number_rule);
+            printf("Other benchmarks skipped: a streamed trace is not kept in memory\n");
+            return 0;
+        }
+        start = std::chrono::steady_clock::now();
+        if (!LoadClassBenchTrace(traceFile, packets, numThreads)) {
+            exit(-1);
+        }
+        end = std::chrono::steady_clock::now();
+        elapsed_milliseconds = end - start;
+        printf("\tTrace load time: %.3f ms\n", elapsed_milliseconds.count());
         uint32_t number_pkt = static_cast<uint32_t>(packets.size());
         const int trials = 10;
         printf("\tTotal packets (run %d times circularly): %lu\n", trials, static_cast<unsigned long>(packets.size() * trials));
@@ -374,9 +574,6 @@ int main(int argc, char *argv[]) {
         // }
         
         // Normal performance testing
-        uint64_t totalMemoryAccess = 0;
-        int worstCaseAccess = 0;
-        
         for (int i = 0; i < trials; i++) {
             start = std::chrono::steady_clock::now();
             for (uint32_t j = 0; j < number_pkt; j++) {
@@ -387,7 +584,7 @@ int main(int argc, char *argv[]) {
             sum_timeT2 += elapsed_seconds;
             
             for (uint32_t j = 0; j < number_pkt; j++) {
-                if (matchid[j] == -1 || static_cast<unsigned int>(matchid[j]) > packets[j][5]) {
+                if (matchid[j] == -1 || static_cast<unsigned int>(matchid[j]) > packets[j].flowId) {
                     match_miss++;
                     
                     //                     //  Debug mode: output misclassification details
@@ -399,16 +596,40 @@ int main(int argc, char *argv[]) {
             }
         }
         
-        // Get memory access statistics
-        totalMemoryAccess = T2.MemoryAccess();
-        worstCaseAccess = T2.WorstMemoryAccess();
-        
         printf("\t%d packets are classified, %d of them are misclassified\n", 
                static_cast<int>(number_pkt * trials), match_miss);
         printf("\tTotal classification time: %.6f s\n", sum_timeT2.count() / trials);
         printf("\tAverage classification time: %.6f us\n", sum_timeT2.count() * 1e6 / (trials * packets.size()));
         printf("\tThroughput: %.6f Mpps\n", 1 / (sum_timeT2.count() * 1e6 / (trials * packets.size())));
-        
+        runLatencyProfile(T2, packets, trials);
+
+        // Batch classification (interleaved tree traversal)
+        int batch_miss = 0;
+        vector<int> batchResult(number_pkt, -1);
+        std::chrono::duration<double> sum_timeBatch(0);
+        for (int i = 0; i < trials; i++) {
+            start = std::chrono::steady_clock::now();
+            T2.ClassifyBatch(packets.data(), number_pkt, batchResult.data());
+            end = std::chrono::steady_clock::now();
+            elapsed_seconds = end - start;
+            sum_timeBatch += elapsed_seconds;
+
+            for (uint32_t j = 0; j < number_pkt; j++) {
+                int id = static_cast<int>(number_rule) - 1 - batchResult[j];
+                if (id == -1 || static_cast<unsigned int>(id) > packets[j].flowId) {
+                    batch_miss++;
+                }
+            }
+        }
+        printf("\tBatch classification: %d of %d packets misclassified\n",
+               batch_miss, static_cast<int>(number_pkt * trials));
+        printf("\tBatch average classification time: %.6f us\n", sum_timeBatch.count() * 1e6 / (trials * packets.size()));
+        printf("\tBatch throughput: %.6f Mpps\n", 1 / (sum_timeBatch.count() * 1e6 / (trials * packets.size())));
+
+        // Multi-core classification: one shared instance, one worker per core
+        int workers = numThreads > 0 ? numThreads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        runWorkerPool(T2, packets, trials, workers, number_rule);
+
         // memory access count statistics output
         // printf("\n=== Memory Access Statistics ===\n");
         // printf("\tTotal memory accesses: %lu\n", totalMemoryAccess);
@@ -427,6 +648,10 @@ int main(int argc, char *argv[]) {
         // printf("================================\n\n");
 
         //---Update Test---
+        if (T2.IsSnapshot()) {
+            printf("Update test skipped: classifier loaded from a snapshot is lookup-only\n");
+            return 0;
+        }
         printf("Update T2Tree\n");
         
         uint32_t number_update = number_rule < MAXRULES ? number_rule : MAXRULES;
@@ -456,6 +681,18 @@ int main(int argc, char *argv[]) {
         printf("\tTotal update time: %.6f s\n", elapsed_seconds.count());
         printf("\tAverage update time: %.6f us\n", elapsed_seconds.count() * 1e6 / number_update);
         printf("\tThroughput: %.6f Mpps\n", 1 / (elapsed_seconds.count() * 1e6 / number_update));
+        if (updateStats.batches > 0) {
+            printf("\tBatch latency: %.3f ms per batch of %u updates\n",
+                   updateStats.batchSeconds * 1e3 / updateStats.batches, number_update / updateStats.batches);
+        }
+
+        //---Concurrent Update Test---
+        // Replays the update set with every operation flipped while lookups keep running
+        printf("Concurrent update T2Tree\n");
+        for (uint32_t i = 0; i < number_update; i++) {
+            operations[i] = 1 - operations[i];
+        }
+        runConcurrentUpdates(T2, packets, updateRules, operations, workers);
         
         // // Debug mode: verify again after update
         // if (VERIFY_CLASSIFICATION) {
@@ -479,12 +716,9 @@ int main(int argc, char *argv[]) {
         // }
         
     } else {
-        printf("Cannot open rule file. Please check the file path.\n");
         printf("Use -h for help.\n");
     }
     
-    if (fpr) fclose(fpr);
-    if (fpt) fclose(fpt);
     
     return 0;
 }
\ No newline at end of file